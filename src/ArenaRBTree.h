@@ -0,0 +1,434 @@
+#ifndef ARENARBTREE_H
+#define ARENARBTREE_H
+
+#include <compare>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Color.h"
+#include "Compare.h"
+
+// Red-Black Tree whose nodes live in one contiguous vector and link to each
+// other through 32-bit indices. The color is packed into the top bit of the
+// parent index, so an ArenaRBTree<int> node takes 16 bytes and a descent
+// walks a single dense array. Index 0 is reserved as the null link, which
+// leaves room for 2^31 - 1 nodes. Erased slots are recycled through a free
+// list threaded through their left links.
+//
+// A slot constructs its payload only while it holds an element: the null
+// slot and erased slots hold none, which they mark in their right link,
+// so erasing destroys the element at once and T need not be copyable or
+// default-constructible.
+template <typename T>
+class ArenaRBTree {
+private:
+    using Index = std::uint32_t;
+
+    static constexpr Index nil = 0;
+    static constexpr Index redBit = Index(1) << 31;
+    static constexpr Index parentMask = redBit - 1;
+    static constexpr Index vacant = ~Index(0); // right link of a slot without payload
+
+    // Copies, moves and destroys its payload only if it holds one, so the
+    // vector can copy and reallocate slots like any other element.
+    struct Node {
+        alignas(T) unsigned char storage[sizeof(T)];
+        Index left = nil;
+        Index right = vacant;
+        Index parentColor = 0;
+
+        Node() = default;
+
+        Node(const Node& other) : left(other.left), parentColor(other.parentColor) {
+            if (other.occupied()) {
+                emplace(other.data());
+                right = other.right;
+            }
+        }
+
+        Node(Node&& other) noexcept(std::is_nothrow_move_constructible_v<T>)
+            : left(other.left), parentColor(other.parentColor) {
+            if (other.occupied()) {
+                emplace(std::move(other.data()));
+                right = other.right;
+            }
+        }
+
+        Node& operator=(const Node& other) {
+            if (this != &other) {
+                clear();
+                left = other.left;
+                parentColor = other.parentColor;
+                if (other.occupied()) {
+                    emplace(other.data());
+                    right = other.right;
+                }
+            }
+            return *this;
+        }
+
+        ~Node() { clear(); }
+
+        bool occupied() const { return right != vacant; }
+
+        T& data() { return *std::launder(reinterpret_cast<T*>(storage)); }
+        const T& data() const { return *std::launder(reinterpret_cast<const T*>(storage)); }
+
+        // The slot becomes occupied, as a leaf, once the payload exists.
+        template <typename... Args>
+        void emplace(Args&&... args) {
+            ::new (static_cast<void*>(storage)) T(std::forward<Args>(args)...);
+            right = nil;
+        }
+
+        void clear() {
+            if (occupied()) {
+                data().~T();
+                right = vacant;
+            }
+        }
+    };
+
+    std::vector<Node> nodes;
+    Index root;
+    Index freeHead;
+
+    Index& left(Index x) { return nodes[x].left; }
+    Index& right(Index x) { return nodes[x].right; }
+    Index left(Index x) const { return nodes[x].left; }
+    Index right(Index x) const { return nodes[x].right; }
+
+    Index parent(Index x) const { return nodes[x].parentColor & parentMask; }
+
+    void setParent(Index x, Index p) {
+        nodes[x].parentColor = (nodes[x].parentColor & redBit) | p;
+    }
+
+    // The null link counts as black.
+    Color color(Index x) const {
+        return x != nil && (nodes[x].parentColor & redBit) ? Color::RED : Color::BLACK;
+    }
+
+    void setColor(Index x, Color c) {
+        if (c == Color::RED)
+            nodes[x].parentColor |= redBit;
+        else
+            nodes[x].parentColor &= parentMask;
+    }
+
+    T& value(Index x) { return nodes[x].data(); }
+    const T& value(Index x) const { return nodes[x].data(); }
+
+    // If constructing the payload throws, the slot stays free.
+    template <typename U>
+    Index createNode(U&& data) {
+        Index x = freeHead;
+        if (x != nil) {
+            nodes[x].emplace(std::forward<U>(data));
+            freeHead = nodes[x].left;
+        } else {
+            if (nodes.size() > parentMask)
+                throw std::length_error("ArenaRBTree: too many nodes");
+            if (nodes.empty())
+                nodes.emplace_back(); // the reserved null slot
+            nodes.emplace_back();
+            x = static_cast<Index>(nodes.size() - 1);
+            try {
+                nodes[x].emplace(std::forward<U>(data));
+            } catch (...) {
+                nodes.pop_back();
+                throw;
+            }
+        }
+        nodes[x].left = nil;
+        nodes[x].parentColor = redBit;
+        return x;
+    }
+
+    void destroyNode(Index x) {
+        nodes[x].clear();
+        nodes[x].left = freeHead;
+        freeHead = x;
+    }
+
+    void leftRotate(Index x) {
+        Index y = right(x);
+        right(x) = left(y);
+        if (left(y))
+            setParent(left(y), x);
+        setParent(y, parent(x));
+        if (!parent(x))
+            root = y;
+        else if (x == left(parent(x)))
+            left(parent(x)) = y;
+        else
+            right(parent(x)) = y;
+        left(y) = x;
+        setParent(x, y);
+    }
+
+    void rightRotate(Index x) {
+        Index y = left(x);
+        left(x) = right(y);
+        if (right(y))
+            setParent(right(y), x);
+        setParent(y, parent(x));
+        if (!parent(x))
+            root = y;
+        else if (x == right(parent(x)))
+            right(parent(x)) = y;
+        else
+            left(parent(x)) = y;
+        right(y) = x;
+        setParent(x, y);
+    }
+
+    void insertFixup(Index z) {
+        while (color(parent(z)) == Color::RED) {
+            Index p = parent(z);
+            Index g = parent(p);
+            if (p == left(g)) {
+                Index y = right(g);
+                if (color(y) == Color::RED) {
+                    setColor(p, Color::BLACK);
+                    setColor(y, Color::BLACK);
+                    setColor(g, Color::RED);
+                    z = g;
+                } else {
+                    if (z == right(p)) {
+                        z = p;
+                        leftRotate(z);
+                    }
+                    setColor(parent(z), Color::BLACK);
+                    setColor(parent(parent(z)), Color::RED);
+                    rightRotate(parent(parent(z)));
+                }
+            } else {
+                Index y = left(g);
+                if (color(y) == Color::RED) {
+                    setColor(p, Color::BLACK);
+                    setColor(y, Color::BLACK);
+                    setColor(g, Color::RED);
+                    z = g;
+                } else {
+                    if (z == left(p)) {
+                        z = p;
+                        rightRotate(z);
+                    }
+                    setColor(parent(z), Color::BLACK);
+                    setColor(parent(parent(z)), Color::RED);
+                    leftRotate(parent(parent(z)));
+                }
+            }
+        }
+        setColor(root, Color::BLACK);
+    }
+
+    void transplant(Index u, Index v) {
+        if (!parent(u))
+            root = v;
+        else if (u == left(parent(u)))
+            left(parent(u)) = v;
+        else
+            right(parent(u)) = v;
+        if (v)
+            setParent(v, parent(u));
+    }
+
+    void removeFixup(Index x, Index xParent) {
+        while (x != root && color(x) == Color::BLACK) {
+            if (x == left(xParent)) {
+                Index w = right(xParent);
+                if (color(w) == Color::RED) {
+                    setColor(w, Color::BLACK);
+                    setColor(xParent, Color::RED);
+                    leftRotate(xParent);
+                    w = right(xParent);
+                }
+                if (color(left(w)) == Color::BLACK && color(right(w)) == Color::BLACK) {
+                    setColor(w, Color::RED);
+                    x = xParent;
+                    xParent = parent(x);
+                } else {
+                    if (color(right(w)) == Color::BLACK) {
+                        setColor(left(w), Color::BLACK);
+                        setColor(w, Color::RED);
+                        rightRotate(w);
+                        w = right(xParent);
+                    }
+                    setColor(w, color(xParent));
+                    setColor(xParent, Color::BLACK);
+                    if (right(w))
+                        setColor(right(w), Color::BLACK);
+                    leftRotate(xParent);
+                    x = root;
+                }
+            } else {
+                Index w = left(xParent);
+                if (color(w) == Color::RED) {
+                    setColor(w, Color::BLACK);
+                    setColor(xParent, Color::RED);
+                    rightRotate(xParent);
+                    w = left(xParent);
+                }
+                if (color(left(w)) == Color::BLACK && color(right(w)) == Color::BLACK) {
+                    setColor(w, Color::RED);
+                    x = xParent;
+                    xParent = parent(x);
+                } else {
+                    if (color(left(w)) == Color::BLACK) {
+                        setColor(right(w), Color::BLACK);
+                        setColor(w, Color::RED);
+                        leftRotate(w);
+                        w = left(xParent);
+                    }
+                    setColor(w, color(xParent));
+                    setColor(xParent, Color::BLACK);
+                    if (left(w))
+                        setColor(left(w), Color::BLACK);
+                    rightRotate(xParent);
+                    x = root;
+                }
+            }
+        }
+        if (x)
+            setColor(x, Color::BLACK);
+    }
+
+    Index minimum(Index x) const {
+        while (left(x))
+            x = left(x);
+        return x;
+    }
+
+    void removeNode(Index z) {
+        Index y = z;
+        Index x;
+        Index xParent;
+        Color originalColor = color(y);
+        if (!left(z)) {
+            x = right(z);
+            xParent = parent(z);
+            transplant(z, right(z));
+        } else if (!right(z)) {
+            x = left(z);
+            xParent = parent(z);
+            transplant(z, left(z));
+        } else {
+            y = minimum(right(z));
+            originalColor = color(y);
+            x = right(y);
+            if (parent(y) == z) {
+                xParent = y;
+                if (x)
+                    setParent(x, y);
+            } else {
+                xParent = parent(y);
+                transplant(y, right(y));
+                right(y) = right(z);
+                setParent(right(y), y);
+            }
+            transplant(z, y);
+            left(y) = left(z);
+            setParent(left(y), y);
+            setColor(y, color(z));
+        }
+        if (originalColor == Color::BLACK)
+            removeFixup(x, xParent);
+        destroyNode(z);
+    }
+
+    // One three-way comparison per level, as in RBTree::findNode.
+    Index locate(const T& key) const {
+        Index x = root;
+        while (x) {
+            std::partial_ordering cmp = compareOrder(std::less<>(), key, value(x));
+            if (cmp < 0)
+                x = left(x);
+            else if (cmp > 0)
+                x = right(x);
+            else
+                break;
+        }
+        return x;
+    }
+
+    void print(Index x, std::string indent, bool last) const {
+        if (x) {
+            std::cout << indent;
+            if (last) {
+                std::cout << "R----";
+                indent += "   ";
+            } else {
+                std::cout << "L----";
+                indent += "|  ";
+            }
+            std::string c = (color(x) == Color::RED) ? "RED" : "BLACK";
+            std::cout << value(x) << "(" << c << ")" << std::endl;
+            print(left(x), indent, false);
+            print(right(x), indent, true);
+        }
+    }
+
+public:
+    static constexpr std::size_t nodeBytes = sizeof(Node);
+
+    ArenaRBTree() : root(nil), freeHead(nil) {}
+
+    // Pre-sizes the arena so the first `count` inserts never reallocate.
+    void reserve(std::size_t count) {
+        nodes.reserve(count + 1);
+    }
+
+    void clear() {
+        nodes.clear();
+        root = freeHead = nil;
+    }
+
+    void insert(T data) {
+        Index y = nil;
+        Index x = root;
+        bool asLeft = false;
+        while (x) {
+            y = x;
+            asLeft = data < value(x);
+            x = asLeft ? left(x) : right(x);
+        }
+
+        Index z = createNode(std::move(data));
+        setParent(z, y);
+        if (!y)
+            root = z;
+        else if (asLeft)
+            left(y) = z;
+        else
+            right(y) = z;
+
+        insertFixup(z);
+    }
+
+    void remove(T data) {
+        if (Index z = locate(data))
+            removeNode(z);
+    }
+
+    // The returned pointer is invalidated by the next insert.
+    const T* search(T data) const {
+        Index x = locate(data);
+        return x ? &value(x) : nullptr;
+    }
+
+    void printTree() const {
+        if (root)
+            print(root, "", true);
+    }
+};
+
+#endif // ARENARBTREE_H
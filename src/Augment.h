@@ -0,0 +1,104 @@
+#ifndef AUGMENT_H
+#define AUGMENT_H
+
+#include <concepts>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// Augmentation policies for RBTree, RBSet and RBMap. A policy gives every
+// node an aggregate of its whole subtree:
+//
+//   static A lift(const Value& v);           // aggregate of one element
+//   static A combine(const A& l, const A& r); // associative, l before r
+//
+// The tree stores combine(combine(left, lift(node)), right), skipping
+// missing children, and refreshes it in O(1) per rotation and O(log n) per
+// insert or erase. Aggregates of subtrees are always combined in key order,
+// so combine need not be commutative.
+template <typename Policy, typename Value>
+concept AugmentPolicy = requires(const Value& value) {
+    Policy::lift(value);
+    { Policy::combine(Policy::lift(value), Policy::lift(value)) } -> std::convertible_to<
+        std::remove_cvref_t<decltype(Policy::lift(value))>>;
+};
+
+template <typename Policy, typename Value>
+using AggregateOf = std::remove_cvref_t<decltype(Policy::lift(std::declval<const Value&>()))>;
+
+template <typename T>
+struct IsPair : std::false_type {};
+
+template <typename A, typename B>
+struct IsPair<std::pair<A, B>> : std::true_type {};
+
+// What the ready-made policies look at: sets aggregate their elements, maps
+// aggregate their mapped values, and interval policies read the key.
+template <typename Value>
+const auto& mappedOf(const Value& value) {
+    if constexpr (IsPair<Value>::value)
+        return value.second;
+    else
+        return value;
+}
+
+template <typename Value>
+const auto& keyPartOf(const Value& value) {
+    if constexpr (IsPair<Value>::value)
+        return value.first;
+    else
+        return value;
+}
+
+// No aggregate; nodes carry no extra data.
+struct NoAugment {};
+
+// Subtree sizes, which enable rank, select and count_between.
+struct OrderStatistics {
+    template <typename Value>
+    static std::size_t lift(const Value&) { return 1; }
+
+    static std::size_t combine(std::size_t left, std::size_t right) { return left + right; }
+};
+
+// Sums of the elements (sets) or mapped values (maps), for range sums.
+struct RangeSum {
+    template <typename Value>
+    static auto lift(const Value& value) { return mappedOf(value); }
+
+    template <typename T>
+    static T combine(const T& left, const T& right) { return left + right; }
+};
+
+// Minimum of the elements (sets) or mapped values (maps), for range minima.
+struct RangeMin {
+    template <typename Value>
+    static auto lift(const Value& value) { return mappedOf(value); }
+
+    template <typename T>
+    static T combine(const T& left, const T& right) { return right < left ? right : left; }
+};
+
+// Closed interval [low, high], ordered by low and then high.
+template <typename T>
+struct Interval {
+    T low;
+    T high;
+
+    auto operator<=>(const Interval&) const = default;
+
+    bool overlaps(const T& lo, const T& hi) const { return !(hi < low) && !(high < lo); }
+};
+
+// Largest high endpoint in each subtree of a tree keyed by Interval, which
+// turns it into an interval tree: subtrees that end before a query starts
+// are skipped whole.
+struct IntervalOverlap {
+    template <typename Value>
+    static auto lift(const Value& value) { return keyPartOf(value).high; }
+
+    template <typename T>
+    static T combine(const T& left, const T& right) { return left < right ? right : left; }
+};
+
+#endif // AUGMENT_H
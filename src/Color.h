@@ -0,0 +1,6 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+enum class Color { RED, BLACK };
+
+#endif // COLOR_H
@@ -0,0 +1,54 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <compare>
+#include <concepts>
+#include <functional>
+#include <type_traits>
+
+// Comparators that accept mixed key types, like std::less<>.
+template <typename Compare>
+concept TransparentCompare = requires { typename Compare::is_transparent; };
+
+// Comparators that return an ordering instead of a bool, like
+// std::compare_three_way.
+template <typename Compare, typename A, typename B>
+concept ThreeWayCompare = requires(const Compare& comp, const A& a, const B& b) {
+    { comp(a, b) } -> std::convertible_to<std::partial_ordering>;
+};
+
+template <typename Compare>
+struct IsStdLess : std::false_type {};
+
+template <typename U>
+struct IsStdLess<std::less<U>> : std::true_type {};
+
+// Whether a orders before b, for either kind of comparator.
+template <typename Compare, typename A, typename B>
+bool compareLess(const Compare& comp, const A& a, const B& b) {
+    if constexpr (ThreeWayCompare<Compare, A, B>)
+        return comp(a, b) < 0;
+    else
+        return comp(a, b);
+}
+
+// One three-way comparison per call wherever the comparator allows it:
+// three-way comparators are used as is and std::less is specialized to
+// operator<=>. Any other less-than comparator needs a second call to
+// tell equivalence from greater.
+template <typename Compare, typename A, typename B>
+std::partial_ordering compareOrder(const Compare& comp, const A& a, const B& b) {
+    if constexpr (ThreeWayCompare<Compare, A, B>) {
+        return comp(a, b);
+    } else if constexpr (IsStdLess<Compare>::value && std::three_way_comparable_with<A, B>) {
+        return std::compare_three_way()(a, b);
+    } else {
+        if (comp(a, b))
+            return std::partial_ordering::less;
+        if (comp(b, a))
+            return std::partial_ordering::greater;
+        return std::partial_ordering::equivalent;
+    }
+}
+
+#endif // COMPARE_H
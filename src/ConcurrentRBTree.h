@@ -0,0 +1,254 @@
+#ifndef CONCURRENTRBTREE_H
+#define CONCURRENTRBTREE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "PersistentRBTree.h"
+
+// Epoch-based reclamation for the concurrent containers. Readers announce
+// the global epoch in a slot of their own while they hold pointers into
+// shared data; a writer retires what it unlinked together with the epoch
+// at that moment and frees it once the epoch has advanced twice, which
+// takes every reader that could still see it to have left. The epoch only
+// advances when all pinned readers have announced the current value.
+//
+// Pinning costs one store to the thread's own cache line and no
+// read-modify-write on shared data, so readers never contend.
+class EpochDomain {
+private:
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> epoch{0}; // 0 while the owner is not pinned
+        std::atomic<bool> inUse{false};
+        unsigned depth = 0;                  // nesting of the owner's pins
+        Slot* next = nullptr;
+    };
+
+    // Gives the slot back when its thread exits.
+    struct Owner {
+        Slot* slot = nullptr;
+
+        ~Owner() {
+            if (slot)
+                slot->inUse.store(false, std::memory_order_release);
+        }
+    };
+
+public:
+    // Pins the calling thread for its lifetime; guards nest.
+    class Guard {
+    public:
+        explicit Guard(EpochDomain& domain) : slot(domain.mySlot()) {
+            if (slot->depth++ == 0)
+                slot->epoch.store(domain.epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard() {
+            if (--slot->depth == 0)
+                slot->epoch.store(0, std::memory_order_release);
+        }
+
+    private:
+        Slot* slot;
+    };
+
+    // One domain per process; it lives until exit so threads may unpin in
+    // any order relative to static destruction.
+    static EpochDomain& instance() {
+        static EpochDomain* domain = new EpochDomain;
+        return *domain;
+    }
+
+    std::uint64_t current() const {
+        return epoch.load(std::memory_order_seq_cst);
+    }
+
+    // Advances the epoch if every pinned thread has announced the current
+    // one, and returns the epoch afterwards. Something retired at epoch e
+    // may be freed once this returns e + 2 or more.
+    std::uint64_t tryAdvance() {
+        std::uint64_t e = epoch.load(std::memory_order_seq_cst);
+        for (Slot* s = slots.load(std::memory_order_acquire); s; s = s->next) {
+            std::uint64_t seen = s->epoch.load(std::memory_order_seq_cst);
+            if (seen != 0 && seen != e)
+                return e;
+        }
+        epoch.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_seq_cst);
+    }
+
+private:
+    std::atomic<std::uint64_t> epoch{1};
+    std::atomic<Slot*> slots{nullptr};
+
+    EpochDomain() = default;
+
+    // Slots are never freed, only handed to the next thread that needs one.
+    Slot* mySlot() {
+        static thread_local Owner owner;
+        if (!owner.slot)
+            owner.slot = acquireSlot();
+        return owner.slot;
+    }
+
+    Slot* acquireSlot() {
+        for (Slot* s = slots.load(std::memory_order_acquire); s; s = s->next) {
+            bool expected = false;
+            if (!s->inUse.load(std::memory_order_relaxed) &&
+                s->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return s;
+        }
+        Slot* s = new Slot;
+        s->inUse.store(true, std::memory_order_relaxed);
+        s->next = slots.load(std::memory_order_relaxed);
+        while (!slots.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        return s;
+    }
+};
+
+// Set of unique keys for read-mostly workloads shared by many threads.
+// Readers take no locks and do no read-modify-write on shared memory: they
+// pin the epoch, load the current root and search an immutable
+// PersistentRBTree version. Writers serialize on a mutex, build the next
+// version by path copying (O(log n) new nodes), publish it with one atomic
+// store and retire the old one through EpochDomain, which frees it once no
+// reader can still be inside it. Nodes the new version shares stay alive.
+template <typename T, typename Compare = std::less<>>
+class ConcurrentRBTree {
+public:
+    using Snapshot = PersistentRBTree<T, Compare>;
+    using value_type = T;
+    using size_type = std::size_t;
+
+private:
+    struct Version {
+        Snapshot tree;
+    };
+
+    std::atomic<const Version*> current;
+    std::mutex writerMutex;
+    std::vector<std::pair<std::uint64_t, const Version*>> retired;
+
+    static EpochDomain& domain() {
+        return EpochDomain::instance();
+    }
+
+    // Called with writerMutex held, after the successor was published.
+    void retire(const Version* old) {
+        retired.emplace_back(domain().current(), old);
+        std::uint64_t e = domain().tryAdvance();
+        std::erase_if(retired, [e](const auto& entry) {
+            if (entry.first + 2 > e)
+                return false;
+            delete entry.second;
+            return true;
+        });
+    }
+
+public:
+    explicit ConcurrentRBTree(const Compare& comp = Compare()) : current(new Version{Snapshot(comp)}) {}
+
+    ConcurrentRBTree(const ConcurrentRBTree&) = delete;
+    ConcurrentRBTree& operator=(const ConcurrentRBTree&) = delete;
+
+    // No other thread may still be using the tree.
+    ~ConcurrentRBTree() {
+        delete current.load(std::memory_order_relaxed);
+        for (const auto& entry : retired)
+            delete entry.second;
+    }
+
+    // Calls fn with the current version while pinned, so fn sees one
+    // consistent state however many lookups it makes. Pointers and
+    // iterators into the version must not escape fn.
+    template <typename F>
+    decltype(auto) read(F&& fn) const {
+        EpochDomain::Guard guard(domain());
+        return fn(current.load(std::memory_order_seq_cst)->tree);
+    }
+
+    // A copy of the element equivalent to key, if any.
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    std::optional<T> find(const K& key) const {
+        return read([&](const Snapshot& tree) -> std::optional<T> {
+            if (const T* found = tree.find(key))
+                return *found;
+            return std::nullopt;
+        });
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    bool contains(const K& key) const {
+        return read([&](const Snapshot& tree) { return tree.contains(key); });
+    }
+
+    size_type size() const {
+        return read([](const Snapshot& tree) { return tree.size(); });
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // Calls fn on every element of one version, in order.
+    template <typename F>
+    void for_each(F&& fn) const {
+        read([&](const Snapshot& tree) {
+            for (const T& value : tree)
+                fn(value);
+        });
+    }
+
+    template <typename K, typename F>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    void for_each_in_range(const K& lo, const K& hi, F&& fn) const {
+        read([&](const Snapshot& tree) { tree.for_each_in_range(lo, hi, fn); });
+    }
+
+    // The current version as an independent persistent tree, for reads
+    // that outlive a pin. Costs one reference count increment.
+    Snapshot snapshot() const {
+        return read([](const Snapshot& tree) { return tree; });
+    }
+
+    // Replaces the current version v with fn(v) as one atomic step, so
+    // several changes can be published together. Returns false, without
+    // publishing, if fn returned v itself.
+    template <typename F>
+    bool update(F&& fn) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        const Version* old = current.load(std::memory_order_relaxed);
+        Snapshot next = fn(old->tree);
+        if (next.same_version(old->tree))
+            return false;
+        current.store(new Version{std::move(next)}, std::memory_order_seq_cst);
+        retire(old);
+        return true;
+    }
+
+    // Whether value was added.
+    bool insert(const T& value) {
+        return update([&](const Snapshot& tree) { return tree.insert(value); });
+    }
+
+    // Whether an element was removed.
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    bool remove(const K& key) {
+        return update([&](const Snapshot& tree) { return tree.remove(key); });
+    }
+};
+
+#endif // CONCURRENTRBTREE_H
@@ -0,0 +1,370 @@
+#ifndef FROZENBTREE_H
+#define FROZENBTREE_H
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FROZENBTREE_X86 1
+#else
+#define FROZENBTREE_X86 0
+#endif
+
+#include "FrozenTree.h"
+#include "RBTree.h"
+
+// Immutable sorted multiset of numbers in an implicit B+ tree, made by
+// copying an RBTree; the layout is the "S+ tree" of Algorithmica's
+// "Static B-Trees". Every node is one 64-byte block of B = 64 / sizeof(T)
+// keys with B + 1 children, so no links are stored and a search reads one
+// cache line per level, log_17 n of them for ints. The leaves are the
+// sorted elements themselves, padded to whole blocks, so iterators are
+// plain pointers and range scans are linear.
+// Above them, key j of block k in each layer is the smallest element
+// under child j + 1, which is block k * (B + 1) + j + 1 of the layer below.
+//
+// A block is ranked against the key with vector compares and a movemask:
+// AVX2 or SSE4.2 where the CPU has them, detected at run time, since the
+// build does not assume either, else a scalar loop. 32- and 64-bit signed
+// integers, float and double are vectorized; other arithmetic types take
+// the scalar path. Floating-point keys must not be NaN.
+template <typename T>
+    requires std::is_arithmetic_v<T>
+class FrozenBTree {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using const_iterator = const T*;
+    using iterator = const_iterator;
+
+    enum class Isa { Scalar, Sse42, Avx2 };
+
+    static constexpr std::size_t blockKeys = std::max<std::size_t>(64 / sizeof(T), 1);
+
+    // The widest instruction set the running CPU supports.
+    static Isa bestIsa() {
+#if FROZENBTREE_X86
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+            return Isa::Avx2;
+        if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+            return Isa::Sse42;
+#endif
+        return Isa::Scalar;
+    }
+
+    FrozenBTree() : elementCount(0), isaInUse(Isa::Scalar) {}
+
+    // For numbers in their natural order: an immutable copy of tree as an
+    // implicit B+ tree of cache-line blocks, each searched with SIMD
+    // compares. isa is lowered to what the CPU supports.
+    template <typename Compare, typename Allocator, typename Augment>
+        requires IsStdLess<Compare>::value
+    explicit FrozenBTree(const RBTree<T, Compare, Allocator, Augment>& tree, Isa isa = bestIsa())
+        : FrozenBTree(tree.begin(), tree.size(), isa) {}
+
+    // Copies the count sorted elements starting at first. isa is lowered
+    // to what the CPU supports.
+    template <std::forward_iterator It>
+    FrozenBTree(It first, std::size_t count, Isa isa = bestIsa())
+        : elementCount(count), isaInUse(std::min(isa, bestIsa())) {
+        if (count == 0)
+            return;
+        // At least one padding slot, so that keys[rank] is readable for
+        // every rank a search returns.
+        std::size_t leafBlocks = count / blockKeys + 1;
+        std::size_t total = 0;
+        for (std::size_t blocks = leafBlocks;; blocks = (blocks + blockKeys) / (blockKeys + 1)) {
+            layerOffsets.push_back(total);
+            total += blocks;
+            if (blocks == 1)
+                break;
+        }
+        keys.reserve(total * blockKeys);
+        for (std::size_t i = 0; i < count; ++i, ++first)
+            keys.push_back(*first);
+        keys.resize(leafBlocks * blockKeys, padding());
+        // Child c of a block in layer h is block c of layer h - 1, whose
+        // leftmost leaf is block c * (B + 1)^(h - 1).
+        std::size_t leavesPerChild = 1;
+        for (std::size_t h = 1; h < layerOffsets.size(); ++h) {
+            std::size_t blocks = (h + 1 < layerOffsets.size() ? layerOffsets[h + 1] : total) - layerOffsets[h];
+            for (std::size_t k = 0; k < blocks; ++k) {
+                for (std::size_t j = 0; j < blockKeys; ++j) {
+                    std::size_t leaf = (k * (blockKeys + 1) + j + 1) * leavesPerChild * blockKeys;
+                    keys.push_back(leaf < count ? keys[leaf] : padding());
+                }
+            }
+            leavesPerChild *= blockKeys + 1;
+        }
+    }
+
+    const_iterator begin() const {
+        return keys.data();
+    }
+
+    const_iterator end() const {
+        return keys.data() + elementCount;
+    }
+
+    bool empty() const {
+        return elementCount == 0;
+    }
+
+    size_type size() const {
+        return elementCount;
+    }
+
+    Isa isa() const {
+        return isaInUse;
+    }
+
+    const_iterator lower_bound(T key) const {
+        return begin() + lowerRank(key);
+    }
+
+    // The first element greater than key is the first not less than the
+    // next representable value, so only lower bounds are searched.
+    const_iterator upper_bound(T key) const {
+        if constexpr (std::is_floating_point_v<T>) {
+            if (key == std::numeric_limits<T>::infinity())
+                return end();
+            return lower_bound(std::nextafter(key, std::numeric_limits<T>::infinity()));
+        } else {
+            if (key == std::numeric_limits<T>::max())
+                return end();
+            return lower_bound(static_cast<T>(key + 1));
+        }
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(T key) const {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    const_iterator find(T key) const {
+        if (elementCount == 0)
+            return end();
+        return begin() + foundRank(key, lowerRank(key));
+    }
+
+    bool contains(T key) const {
+        return find(key) != end();
+    }
+
+    size_type count(T key) const {
+        auto [lo, hi] = equal_range(key);
+        return static_cast<size_type>(hi - lo);
+    }
+
+    // Calls fn on every element in [lo, hi), in order.
+    template <typename F>
+    void for_each_in_range(T lo, T hi, F&& fn) const {
+        for (const_iterator it = lower_bound(lo); it != end() && *it < hi; ++it)
+            fn(*it);
+    }
+
+    // out[i] = find(queries[i]) for every i. Runs findManyGroup searches in
+    // lockstep, one level at a time, and prefetches the block each moves
+    // to, so their misses overlap. Throws std::invalid_argument if out is
+    // not as long as queries.
+    void find_many(std::span<const T> queries, std::span<const_iterator> out) const {
+        if (out.size() != queries.size())
+            throw std::invalid_argument("find_many: out must be as long as queries");
+        switch (isaInUse) {
+#if FROZENBTREE_X86
+        case Isa::Avx2:
+            findManyAvx2(queries, out);
+            return;
+        case Isa::Sse42:
+            findManySse42(queries, out);
+            return;
+#endif
+        default:
+            findManyIn<Scalar>(queries, out);
+        }
+    }
+
+private:
+    static constexpr std::size_t findManyGroup = 16;
+
+    std::vector<T, CacheLineAllocator<T>> keys; // leaves first, then each layer up to the root
+    std::vector<std::size_t> layerOffsets;      // first block of each layer
+    std::size_t elementCount;
+    Isa isaInUse;
+
+    // Pads blocks; never less than a key, so no search enters the empty
+    // subtrees it stands for.
+    static constexpr T padding() {
+        if constexpr (std::is_floating_point_v<T>)
+            return std::numeric_limits<T>::infinity();
+        else
+            return std::numeric_limits<T>::max();
+    }
+
+    // rank if the element there is equivalent to key, else elementCount.
+    // Hits and misses of random keys are unpredictable, so this selects
+    // rather than branches.
+    std::size_t foundRank(T key, std::size_t rank) const {
+        bool found = (rank < elementCount) & !(key < keys[rank]);
+        return found ? rank : elementCount;
+    }
+
+    const T* block(std::size_t layer, std::size_t k) const {
+        return keys.data() + (layerOffsets[layer] + k) * blockKeys;
+    }
+
+    // Number of keys in a sorted block that are less than x.
+    struct Scalar {
+        static unsigned rank(const T* block, T x) {
+            unsigned r = 0;
+            for (std::size_t j = 0; j < blockKeys; ++j)
+                r += block[j] < x;
+            return r;
+        }
+    };
+
+#if FROZENBTREE_X86
+    static constexpr bool vectorized =
+        (std::is_integral_v<T> && std::is_signed_v<T> && (sizeof(T) == 4 || sizeof(T) == 8)) ||
+        std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+    // In a sorted block the keys below x form a prefix, so its length is
+    // the number of set lanes in the compare masks. Their order does not
+    // matter, so the masks are narrowed with saturating packs, which keep
+    // all-ones lanes all-ones, and read out with a single movemask; each
+    // key then owns sizeof(T) / 2 bits of it with AVX2 and sizeof(T) / 4
+    // with SSE.
+    struct Avx2 {
+        // All-ones in the lanes of the 32 bytes at p that are less than x.
+        __attribute__((target("avx2"))) static __m256i lessMask(const T* p, T x) {
+            if constexpr (std::is_same_v<T, float>)
+                return _mm256_castps_si256(_mm256_cmp_ps(_mm256_load_ps(p), _mm256_set1_ps(x), _CMP_LT_OQ));
+            else if constexpr (std::is_same_v<T, double>)
+                return _mm256_castpd_si256(_mm256_cmp_pd(_mm256_load_pd(p), _mm256_set1_pd(x), _CMP_LT_OQ));
+            else if constexpr (sizeof(T) == 4)
+                return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(x)),
+                                          _mm256_load_si256(reinterpret_cast<const __m256i*>(p)));
+            else
+                return _mm256_cmpgt_epi64(_mm256_set1_epi64x(static_cast<long long>(x)),
+                                          _mm256_load_si256(reinterpret_cast<const __m256i*>(p)));
+        }
+
+        __attribute__((target("avx2,popcnt"))) static unsigned rank(const T* block, T x) {
+            if constexpr (!vectorized) {
+                return Scalar::rank(block, x);
+            } else {
+                __m256i packed = _mm256_packs_epi32(lessMask(block, x), lessMask(block + 32 / sizeof(T), x));
+                constexpr unsigned bitsPerKey = sizeof(T) / 2;
+                return static_cast<unsigned>(std::popcount(static_cast<unsigned>(_mm256_movemask_epi8(packed)))) / bitsPerKey;
+            }
+        }
+    };
+
+    struct Sse42 {
+        // All-ones in the lanes of the 16 bytes at p that are less than x.
+        __attribute__((target("sse4.2"))) static __m128i lessMask(const T* p, T x) {
+            if constexpr (std::is_same_v<T, float>)
+                return _mm_castps_si128(_mm_cmplt_ps(_mm_load_ps(p), _mm_set1_ps(x)));
+            else if constexpr (std::is_same_v<T, double>)
+                return _mm_castpd_si128(_mm_cmplt_pd(_mm_load_pd(p), _mm_set1_pd(x)));
+            else if constexpr (sizeof(T) == 4)
+                return _mm_cmpgt_epi32(_mm_set1_epi32(static_cast<int>(x)),
+                                       _mm_load_si128(reinterpret_cast<const __m128i*>(p)));
+            else
+                return _mm_cmpgt_epi64(_mm_set1_epi64x(static_cast<long long>(x)),
+                                       _mm_load_si128(reinterpret_cast<const __m128i*>(p)));
+        }
+
+        __attribute__((target("sse4.2,popcnt"))) static unsigned rank(const T* block, T x) {
+            if constexpr (!vectorized) {
+                return Scalar::rank(block, x);
+            } else {
+                constexpr std::size_t lanes = 16 / sizeof(T);
+                __m128i low = _mm_packs_epi32(lessMask(block, x), lessMask(block + lanes, x));
+                __m128i high = _mm_packs_epi32(lessMask(block + 2 * lanes, x), lessMask(block + 3 * lanes, x));
+                __m128i packed = _mm_packs_epi16(low, high);
+                constexpr unsigned bitsPerKey = sizeof(T) / 4;
+                return static_cast<unsigned>(std::popcount(static_cast<unsigned>(_mm_movemask_epi8(packed)))) / bitsPerKey;
+            }
+        }
+    };
+
+    __attribute__((target("avx2,popcnt"))) std::size_t lowerRankAvx2(T x) const {
+        return lowerRankIn<Avx2>(x);
+    }
+
+    __attribute__((target("sse4.2,popcnt"))) std::size_t lowerRankSse42(T x) const {
+        return lowerRankIn<Sse42>(x);
+    }
+
+    __attribute__((target("avx2,popcnt"))) void findManyAvx2(std::span<const T> queries,
+                                                             std::span<const_iterator> out) const {
+        findManyIn<Avx2>(queries, out);
+    }
+
+    __attribute__((target("sse4.2,popcnt"))) void findManySse42(std::span<const T> queries,
+                                                                std::span<const_iterator> out) const {
+        findManyIn<Sse42>(queries, out);
+    }
+#endif
+
+    // The rank of the first element not less than x, from the root layer
+    // down: the rank within a block picks the child, and within a leaf it
+    // is the answer. Inlined into each per-ISA entry point so the vector
+    // compares are inlined too.
+    template <typename Rank>
+    [[gnu::always_inline]] std::size_t lowerRankIn(T x) const {
+        std::size_t k = 0;
+        for (std::size_t h = layerOffsets.size(); h-- > 1;)
+            k = k * (blockKeys + 1) + Rank::rank(block(h, k), x);
+        return k * blockKeys + Rank::rank(block(0, k), x);
+    }
+
+    std::size_t lowerRank(T x) const {
+        if (elementCount == 0)
+            return 0;
+        switch (isaInUse) {
+#if FROZENBTREE_X86
+        case Isa::Avx2:
+            return lowerRankAvx2(x);
+        case Isa::Sse42:
+            return lowerRankSse42(x);
+#endif
+        default:
+            return lowerRankIn<Scalar>(x);
+        }
+    }
+
+    template <typename Rank>
+    [[gnu::always_inline]] void findManyIn(std::span<const T> queries, std::span<const_iterator> out) const {
+        if (elementCount == 0) {
+            std::fill(out.begin(), out.end(), end());
+            return;
+        }
+        std::size_t path[findManyGroup];
+        for (std::size_t first = 0; first < queries.size(); first += findManyGroup) {
+            std::size_t n = std::min(findManyGroup, queries.size() - first);
+            const T* x = queries.data() + first;
+            std::fill(path, path + n, 0);
+            for (std::size_t h = layerOffsets.size(); h-- > 1;) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    path[i] = path[i] * (blockKeys + 1) + Rank::rank(block(h, path[i]), x[i]);
+                    __builtin_prefetch(block(h - 1, path[i]));
+                }
+            }
+            for (std::size_t i = 0; i < n; ++i)
+                out[first + i] = begin() + foundRank(x[i], path[i] * blockKeys + Rank::rank(block(0, path[i]), x[i]));
+        }
+    }
+};
+
+#endif // FROZENBTREE_H
@@ -0,0 +1,258 @@
+#ifndef FROZENTREE_H
+#define FROZENTREE_H
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "Compare.h"
+#include "RBTree.h"
+
+// Allocates on cache line boundaries.
+template <typename T>
+struct CacheLineAllocator {
+    using value_type = T;
+
+    static constexpr std::align_val_t alignment{64};
+
+    CacheLineAllocator() = default;
+
+    template <typename U>
+    CacheLineAllocator(const CacheLineAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), alignment));
+    }
+
+    void deallocate(T* p, std::size_t) {
+        ::operator delete(p, alignment);
+    }
+
+    friend bool operator==(const CacheLineAllocator&, const CacheLineAllocator&) {
+        return true;
+    }
+};
+
+// Immutable sorted multiset for data that is built once and then only
+// queried, copied from an RBTree. The elements sit in one array in
+// Eytzinger order, the breadth-first layout of a complete binary tree:
+// slot k has its children in 2k and 2k + 1, so no links are stored and the
+// top levels every search passes through share a few cache lines.
+//
+// A search is the index walk k = 2k + (a[k] < key), with nothing to
+// mispredict but the loop exit. The 64 / sizeof(T) descendants that many
+// levels below k are adjacent and, with the array line-aligned, fill one
+// cache line, so each step prefetches the line needed four levels later
+// for ints (Khuong and Morin, "Array Layouts for Comparison-Based
+// Searching").
+template <typename T, typename Compare = std::less<>>
+class FrozenTree {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using key_compare = Compare;
+
+    // In-order traversal of the implicit tree; amortized O(1) per step.
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+
+        reference operator*() const { return tree->keys[index]; }
+        pointer operator->() const { return &tree->keys[index]; }
+
+        const_iterator& operator++() {
+            index = tree->nextIndex(index);
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        friend bool operator==(const const_iterator& a, const const_iterator& b) {
+            return a.index == b.index;
+        }
+
+    private:
+        friend class FrozenTree;
+
+        const FrozenTree* tree = nullptr;
+        std::size_t index = 0; // 0 past the end
+
+        const_iterator(const FrozenTree* owner, std::size_t slot) : tree(owner), index(slot) {}
+    };
+
+    using iterator = const_iterator;
+
+    explicit FrozenTree(const Compare& compare = Compare()) : elementCount(0), comp(compare) {}
+
+    // An immutable copy of tree in one cache-friendly array with the same
+    // lookups, for data that is queried far more often than it changes.
+    template <typename Allocator, typename Augment>
+    explicit FrozenTree(const RBTree<T, Compare, Allocator, Augment>& tree)
+        : FrozenTree(tree.begin(), tree.size(), tree.key_comp()) {}
+
+    // Copies the count sorted elements starting at first.
+    template <std::forward_iterator It>
+    FrozenTree(It first, std::size_t count, const Compare& compare = Compare()) : elementCount(count), comp(compare) {
+        if (count == 0)
+            return;
+        std::vector<const T*> bySlot(count + 1);
+        for (std::size_t k = leftmostFrom(1); k != 0; k = nextIndex(k), ++first)
+            bySlot[k] = &*first;
+        // Slot 0 is never searched; it holds a copy so that slot k is keys[k].
+        keys.reserve(count + 1);
+        keys.push_back(*bySlot[1]);
+        for (std::size_t k = 1; k <= count; ++k)
+            keys.push_back(*bySlot[k]);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, elementCount ? leftmostFrom(1) : 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, 0);
+    }
+
+    bool empty() const {
+        return elementCount == 0;
+    }
+
+    size_type size() const {
+        return elementCount;
+    }
+
+    Compare key_comp() const {
+        return comp;
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    const_iterator find(const K& key) const {
+        return const_iterator(this, findIndex(key));
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    bool contains(const K& key) const {
+        return findIndex(key) != 0;
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    size_type count(const K& key) const {
+        size_type n = 0;
+        for (std::size_t k = lowerBoundIndex(key); k != 0 && !less(key, keys[k]); k = nextIndex(k))
+            ++n;
+        return n;
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    const_iterator lower_bound(const K& key) const {
+        return const_iterator(this, lowerBoundIndex(key));
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    const_iterator upper_bound(const K& key) const {
+        return const_iterator(this, upperBoundIndex(key));
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    // Calls fn on every element in [lo, hi), in order.
+    template <typename K, typename F>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    void for_each_in_range(const K& lo, const K& hi, F&& fn) const {
+        for (std::size_t k = lowerBoundIndex(lo); k != 0 && less(keys[k], hi); k = nextIndex(k))
+            fn(keys[k]);
+    }
+
+private:
+    // Descendants this many slots apart start a new cache line; at least
+    // two levels ahead for elements too large to share one.
+    static constexpr std::size_t prefetchStride = std::bit_floor(std::max<std::size_t>(64 / sizeof(T), 4));
+
+    std::vector<T, CacheLineAllocator<T>> keys;
+    std::size_t elementCount;
+    Compare comp;
+
+    template <typename A, typename B>
+    bool less(const A& a, const B& b) const {
+        return compareLess(comp, a, b);
+    }
+
+    // The first slot of k's subtree in order.
+    std::size_t leftmostFrom(std::size_t k) const {
+        while (2 * k <= elementCount)
+            k *= 2;
+        return k;
+    }
+
+    // The slot after k in order, or 0 after the last. Without a right
+    // subtree, the next slot is the parent of the last left turn, found by
+    // dropping the trailing right turns and one more bit.
+    std::size_t nextIndex(std::size_t k) const {
+        if (2 * k + 1 <= elementCount)
+            return leftmostFrom(2 * k + 1);
+        return k >> (std::countr_one(k) + 1);
+    }
+
+    // Walks down while goRight(a[k]), then undoes the right turns taken
+    // after the last left one: that node is the first for which goRight
+    // failed, or 0 if there was none.
+    template <typename GoRight>
+    std::size_t descend(GoRight goRight) const {
+        const T* base = keys.data();
+        std::size_t k = 1;
+        while (k <= elementCount) {
+            __builtin_prefetch(base + k * prefetchStride);
+            k = 2 * k + static_cast<std::size_t>(goRight(base[k]));
+        }
+        return k >> (std::countr_one(k) + 1);
+    }
+
+    template <typename K>
+    std::size_t lowerBoundIndex(const K& key) const {
+        return descend([&](const T& x) { return less(x, key); });
+    }
+
+    template <typename K>
+    std::size_t upperBoundIndex(const K& key) const {
+        return descend([&](const T& x) { return !less(key, x); });
+    }
+
+    // Hits and misses of random keys are unpredictable, so the final test
+    // is masked in rather than branched on. Slot 0 makes keys[k] valid for
+    // k == 0.
+    template <typename K>
+    std::size_t findIndex(const K& key) const {
+        if (elementCount == 0)
+            return 0;
+        std::size_t k = lowerBoundIndex(key);
+        std::size_t found = !less(key, keys[k]);
+        return k & (0 - found);
+    }
+};
+
+#endif // FROZENTREE_H
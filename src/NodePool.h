@@ -0,0 +1,174 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Fixed-size block pool. Blocks are carved out of large slabs and freed
+// blocks are recycled through an intrusive free list, so once the pool has
+// grown to the working set size it never calls into the global heap again.
+// A pool is not thread-safe; give every tree its own.
+class NodePool {
+public:
+    NodePool(std::size_t size, std::size_t align, std::size_t blocksPerSlab = 1024)
+        : blockAlign(alignmentFor(align)),
+          blockSize(blockSizeFor(size, align)),
+          slabBlocks(blocksPerSlab ? blocksPerSlab : 1),
+          freeList(nullptr) {}
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    ~NodePool() {
+        for (void* slab : slabs)
+            ::operator delete(slab, std::align_val_t(blockAlign));
+    }
+
+    void* allocate() {
+        if (!freeList)
+            grow();
+        FreeBlock* block = freeList;
+        freeList = block->next;
+        return block;
+    }
+
+    void deallocate(void* p) noexcept {
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = freeList;
+        freeList = block;
+    }
+
+    static std::size_t alignmentFor(std::size_t align) {
+        return align < alignof(FreeBlock) ? alignof(FreeBlock) : align;
+    }
+
+    // Blocks must be able to hold a free-list link and keep every block in
+    // a slab aligned.
+    static std::size_t blockSizeFor(std::size_t size, std::size_t align) {
+        align = alignmentFor(align);
+        size = size < sizeof(FreeBlock) ? sizeof(FreeBlock) : size;
+        return (size + align - 1) / align * align;
+    }
+
+    std::size_t blockBytes() const { return blockSize; }
+
+    std::size_t alignment() const { return blockAlign; }
+
+    std::size_t blocksPerSlab() const { return slabBlocks; }
+
+    std::size_t slabCount() const { return slabs.size(); }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    void grow() {
+        slabs.reserve(slabs.size() + 1);
+        char* slab = static_cast<char*>(::operator new(blockSize * slabBlocks, std::align_val_t(blockAlign)));
+        slabs.push_back(slab);
+        // Thread the new blocks onto the free list in address order.
+        for (std::size_t i = slabBlocks; i-- > 0;)
+            deallocate(slab + i * blockSize);
+    }
+
+    std::size_t blockAlign;
+    std::size_t blockSize;
+    std::size_t slabBlocks;
+    FreeBlock* freeList;
+    std::vector<void*> slabs;
+};
+
+// The pools shared by an allocator and all of its rebound copies, one per
+// block size and alignment.
+class PoolResource {
+public:
+    explicit PoolResource(std::size_t blocksPerSlab = 1024) : slabBlocks(blocksPerSlab) {}
+
+    NodePool& poolFor(std::size_t size, std::size_t align) {
+        for (auto& pool : pools) {
+            if (pool->blockBytes() == NodePool::blockSizeFor(size, align) &&
+                pool->alignment() == NodePool::alignmentFor(align))
+                return *pool;
+        }
+        pools.push_back(std::make_unique<NodePool>(size, align, slabBlocks));
+        return *pools.back();
+    }
+
+    std::size_t blocksPerSlab() const { return slabBlocks; }
+
+    std::size_t slabCount() const {
+        std::size_t count = 0;
+        for (const auto& pool : pools)
+            count += pool->slabCount();
+        return count;
+    }
+
+private:
+    std::size_t slabBlocks;
+    std::vector<std::unique_ptr<NodePool>> pools;
+};
+
+// Allocator that serves single-object allocations from a NodePool. Copies and
+// rebinds share one PoolResource; copy-constructing a container starts a
+// fresh one, so every tree owns its pools and never contends with other
+// trees. Larger requests fall back to the global heap.
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit PoolAllocator(std::size_t blocksPerSlab = 1024)
+        : PoolAllocator(std::make_shared<PoolResource>(blocksPerSlab)) {}
+
+    // Copies only: a moved-from allocator must still own a resource, since
+    // the container it came from keeps using it. Declaring the copies
+    // suppresses the implicit moves, so moves copy the shared_ptr instead.
+    PoolAllocator(const PoolAllocator&) = default;
+    PoolAllocator& operator=(const PoolAllocator&) = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : PoolAllocator(other.shared) {}
+
+    T* allocate(std::size_t n) {
+        if (n == 1)
+            return static_cast<T*>(pool->allocate());
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        if (n == 1)
+            pool->deallocate(p);
+        else
+            std::allocator<T>().deallocate(p, n);
+    }
+
+    PoolAllocator select_on_container_copy_construction() const {
+        return PoolAllocator(shared->blocksPerSlab());
+    }
+
+    const PoolResource& resource() const { return *shared; }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const {
+        return shared == other.shared;
+    }
+
+private:
+    template <typename U>
+    friend class PoolAllocator;
+
+    explicit PoolAllocator(std::shared_ptr<PoolResource> resource)
+        : shared(std::move(resource)), pool(&shared->poolFor(sizeof(T), alignof(T))) {}
+
+    std::shared_ptr<PoolResource> shared;
+    NodePool* pool;
+};
+
+#endif // NODEPOOL_H
@@ -0,0 +1,335 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Fork-join thread pool with one task deque per worker. invoke(a, b)
+// pushes b onto the calling worker's deque and runs a itself; idle workers
+// steal from the opposite end of other deques, so the oldest and largest
+// subproblems migrate first. A worker waiting for a stolen task runs other
+// tasks meanwhile and sleeps only when there are none. Threads outside the
+// pool enter through a shared queue.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threads = std::thread::hardware_concurrency())
+        : queues(threads ? threads : 1), stopping(false), epoch(0) {
+        for (unsigned i = 0; i < queues.size(); ++i)
+            queues[i] = std::make_unique<Queue>();
+        for (unsigned i = 0; i < queues.size(); ++i)
+            workers.emplace_back([this, i] { work(i); });
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+    // Runs a and b, possibly in parallel, and returns once both finished.
+    // An exception from either is rethrown after both are done.
+    template <typename A, typename B>
+    void invoke(A&& a, B&& b) {
+        if (currentPool != this) {
+            run([&] { invoke(a, b); });
+            return;
+        }
+        Task task(b);
+        push(currentIndex, &task);
+        std::exception_ptr error;
+        try {
+            a();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if (popBack(currentIndex, &task))
+            task.run();
+        else
+            join(&task);
+        if (error)
+            std::rethrow_exception(error);
+        if (task.error)
+            std::rethrow_exception(task.error);
+    }
+
+    // Runs fn on a worker and waits for it; from inside the pool it just
+    // calls fn.
+    template <typename F>
+    void run(F&& fn) {
+        if (currentPool == this) {
+            fn();
+            return;
+        }
+        Task task(fn);
+        {
+            std::lock_guard<std::mutex> lock(injectMutex);
+            injected.push_back(&task);
+        }
+        signal();
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [&] { return task.done; });
+        }
+        if (task.error)
+            std::rethrow_exception(task.error);
+    }
+
+private:
+    // Lives on the stack of the thread that waits for it. done is guarded
+    // by sleepMutex, and the waiter may destroy the task as soon as it sees
+    // done set.
+    struct Task {
+        template <typename F>
+        explicit Task(F& f)
+            : call([](void* p) { (*static_cast<F*>(p))(); }),
+              fn(const_cast<void*>(static_cast<const void*>(&f))),
+              done(false) {}
+
+        void run() {
+            try {
+                call(fn);
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+
+        void (*call)(void*);
+        void* fn;
+        std::exception_ptr error;
+        bool done;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task*> tasks;
+    };
+
+    // Runs a task taken from a queue. Once done is set the task may be
+    // gone, so the wake-up goes through the pool's own condition variable.
+    void execute(Task* task) {
+        task->run();
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            task->done = true;
+        }
+        wake.notify_all();
+    }
+
+    // Waits for a task a thief took, running other tasks meanwhile and
+    // sleeping as an idle worker would when there are none.
+    void join(Task* task) {
+        for (;;) {
+            std::uint64_t seen;
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                if (task->done)
+                    return;
+                seen = epoch;
+            }
+            if (Task* other = find(currentIndex)) {
+                execute(other);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [&] { return task->done || epoch != seen; });
+        }
+    }
+
+    void push(unsigned index, Task* task) {
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(task);
+        }
+        signal();
+    }
+
+    // Takes task back unless a thief got it first.
+    bool popBack(unsigned index, Task* task) {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        auto& tasks = queues[index]->tasks;
+        if (tasks.empty() || tasks.back() != task)
+            return false;
+        tasks.pop_back();
+        return true;
+    }
+
+    // The newest own task, else the oldest task of another worker, else an
+    // injected one.
+    Task* find(unsigned index) {
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            auto& tasks = queues[index]->tasks;
+            if (!tasks.empty()) {
+                Task* task = tasks.back();
+                tasks.pop_back();
+                return task;
+            }
+        }
+        for (std::size_t i = 1; i < queues.size(); ++i) {
+            Queue& victim = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                Task* task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        std::lock_guard<std::mutex> lock(injectMutex);
+        if (injected.empty())
+            return nullptr;
+        Task* task = injected.front();
+        injected.pop_front();
+        return task;
+    }
+
+    // Bumping the epoch under the sleep mutex means a worker that found no
+    // task cannot miss the wake-up for one pushed right after it looked.
+    // Joining workers and outside callers sleep on the same condition
+    // variable and may leave without taking the task, so all are woken.
+    void signal() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            ++epoch;
+        }
+        wake.notify_all();
+    }
+
+    void work(unsigned index) {
+        currentPool = this;
+        currentIndex = index;
+        for (;;) {
+            std::uint64_t seen;
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                if (stopping)
+                    return;
+                seen = epoch;
+            }
+            if (Task* task = find(index)) {
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [&] { return stopping || epoch != seen; });
+        }
+    }
+
+    static inline thread_local WorkStealingPool* currentPool = nullptr;
+    static inline thread_local unsigned currentIndex = 0;
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex injectMutex;
+    std::deque<Task*> injected;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::uint64_t epoch;
+};
+
+// Lets a bulk operation fan out over pool. Subproblems with fewer than
+// cutoff elements run sequentially on the worker that reached them.
+struct Parallelism {
+    WorkStealingPool& pool;
+    std::size_t cutoff = std::size_t(1) << 14;
+};
+
+// Calls fn(lo, hi) on disjoint chunks of [first, last) of at most cutoff
+// indices, splitting recursively over the pool.
+template <typename F>
+void parallelFor(WorkStealingPool& pool, std::size_t first, std::size_t last, std::size_t cutoff, const F& fn) {
+    if (last - first <= std::max<std::size_t>(cutoff, 1)) {
+        fn(first, last);
+        return;
+    }
+    std::size_t mid = first + (last - first) / 2;
+    pool.invoke([&] { parallelFor(pool, first, mid, cutoff, fn); },
+                [&] { parallelFor(pool, mid, last, cutoff, fn); });
+}
+
+// Stable merge of the sorted runs [a, aEnd) and [b, bEnd), moved into out.
+// Runs longer than cutoff in total are cut at the median of the longer run;
+// the other run is cut at the matching bound, keeping equal elements from
+// the first run ahead of those from the second, and the two merges below
+// and above the cut run as a fork-join pair.
+template <typename InIt, typename OutIt, typename Less>
+void parallelMerge(WorkStealingPool& pool, InIt a, InIt aEnd, InIt b, InIt bEnd, OutIt out, std::size_t cutoff,
+                   const Less& less) {
+    std::size_t aCount = static_cast<std::size_t>(aEnd - a);
+    std::size_t bCount = static_cast<std::size_t>(bEnd - b);
+    if (aCount + bCount <= std::max<std::size_t>(cutoff, 1) || aCount == 0 || bCount == 0) {
+        std::merge(std::make_move_iterator(a), std::make_move_iterator(aEnd), std::make_move_iterator(b),
+                   std::make_move_iterator(bEnd), out, less);
+        return;
+    }
+    InIt aCut, bCut;
+    if (aCount >= bCount) {
+        aCut = a + aCount / 2;
+        bCut = std::lower_bound(b, bEnd, *aCut, less);
+    } else {
+        bCut = b + bCount / 2;
+        aCut = std::upper_bound(a, aEnd, *bCut, less);
+    }
+    OutIt outCut = out + ((aCut - a) + (bCut - b));
+    pool.invoke([&] { parallelMerge(pool, a, aCut, b, bCut, out, cutoff, less); },
+                [&] { parallelMerge(pool, aCut, aEnd, bCut, bEnd, outCut, cutoff, less); });
+}
+
+// Sorts the n elements at from, leaving the result at from or, if
+// intoOther, at other. The halves sort into the buffer the merge does not
+// write to, so each level moves every element once.
+template <typename RandomIt, typename BufferIt, typename Less>
+void parallelSortRuns(WorkStealingPool& pool, RandomIt from, BufferIt other, std::size_t n, bool intoOther,
+                      std::size_t cutoff, const Less& less) {
+    if (n <= std::max<std::size_t>(cutoff, 1)) {
+        std::stable_sort(from, from + n, less);
+        if (intoOther)
+            std::move(from, from + n, other);
+        return;
+    }
+    std::size_t mid = n / 2;
+    pool.invoke([&] { parallelSortRuns(pool, from, other, mid, !intoOther, cutoff, less); },
+                [&] { parallelSortRuns(pool, from + mid, other + mid, n - mid, !intoOther, cutoff, less); });
+    if (intoOther)
+        parallelMerge(pool, from, from + mid, from + mid, from + n, other, cutoff, less);
+    else
+        parallelMerge(pool, other, other + mid, other + mid, other + n, from, cutoff, less);
+}
+
+// Stable merge sort over the pool. The range moves into a scratch buffer
+// once; halves of anything longer than cutoff sort as a fork-join pair and
+// are merged in parallel back and forth between the range and the buffer,
+// and ranges of at most cutoff use std::stable_sort.
+template <typename RandomIt, typename Less>
+void parallelStableSort(WorkStealingPool& pool, RandomIt first, RandomIt last, std::size_t cutoff,
+                        const Less& less) {
+    std::size_t n = static_cast<std::size_t>(last - first);
+    if (n <= std::max<std::size_t>(cutoff, 1)) {
+        std::stable_sort(first, last, less);
+        return;
+    }
+    using Value = typename std::iterator_traits<RandomIt>::value_type;
+    std::vector<Value> scratch(std::make_move_iterator(first), std::make_move_iterator(last));
+    parallelSortRuns(pool, scratch.begin(), first, n, true, cutoff, less);
+}
+
+#endif // PARALLEL_H
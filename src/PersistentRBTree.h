@@ -0,0 +1,395 @@
+#ifndef PERSISTENTRBTREE_H
+#define PERSISTENTRBTREE_H
+
+#include <compare>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Color.h"
+#include "Compare.h"
+
+// Immutable Red-Black set of unique keys. insert and remove leave the tree
+// they are called on untouched and return a new version that shares every
+// subtree off the search path with it, so an update allocates O(log n)
+// nodes and copying a version is O(1).
+//
+// Nodes are shared between versions and have no parent pointers. Updates
+// rebalance with join instead (Blelloch, Ferizovic and Sun, "Just Join for
+// Parallel Ordered Sets"): every node stores its black height, and join
+// glues two trees and a middle key back together in time proportional to
+// their height difference, which is O(1) per level on the way up.
+//
+// A version never changes once built, so any number of threads may read
+// it without locks; node lifetimes are tracked by shared_ptr. Iterators
+// and element pointers stay valid for as long as a version holding them
+// is alive.
+template <typename T, typename Compare = std::less<>>
+class PersistentRBTree {
+private:
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node {
+        T data;
+        NodePtr left;
+        NodePtr right;
+        Color color;
+        std::uint8_t blackHeight; // black nodes on a path down to null, this one included
+
+        Node(const T& value, NodePtr leftChild, NodePtr rightChild, Color nodeColor)
+            : data(value), left(std::move(leftChild)), right(std::move(rightChild)), color(nodeColor),
+              blackHeight(static_cast<std::uint8_t>(blackHeightOf(left) + (nodeColor == Color::BLACK))) {}
+    };
+
+    NodePtr root;
+    std::size_t count;
+    Compare comp;
+
+    PersistentRBTree(NodePtr top, std::size_t size, const Compare& compare)
+        : root(std::move(top)), count(size), comp(compare) {}
+
+    // Null children count as black leaves of black height 0.
+    static Color colorOf(const NodePtr& x) {
+        return x ? x->color : Color::BLACK;
+    }
+
+    static int blackHeightOf(const NodePtr& x) {
+        return x ? x->blackHeight : 0;
+    }
+
+    static NodePtr makeNode(const T& data, NodePtr left, NodePtr right, Color color) {
+        return std::make_shared<const Node>(data, std::move(left), std::move(right), color);
+    }
+
+    static NodePtr withColor(const NodePtr& x, Color color) {
+        return x->color == color ? x : makeNode(x->data, x->left, x->right, color);
+    }
+
+    template <typename A, typename B>
+    std::partial_ordering order(const A& a, const B& b) const {
+        return compareOrder(comp, a, b);
+    }
+
+    // Walks down the right spine of l, which is the taller tree, to the
+    // first black node as tall as r and hangs (that node, key, r) there as a
+    // red node. A red-red pair this creates below a black node is removed
+    // by a left rotation at that node.
+    static NodePtr joinRight(const NodePtr& l, const T& key, const NodePtr& r) {
+        if (colorOf(l) == Color::BLACK && blackHeightOf(l) == blackHeightOf(r))
+            return makeNode(key, l, r, Color::RED);
+        NodePtr right = joinRight(l->right, key, r);
+        if (l->color == Color::BLACK && colorOf(right) == Color::RED && colorOf(right->right) == Color::RED) {
+            NodePtr lower = makeNode(l->data, l->left, right->left, Color::BLACK);
+            return makeNode(right->data, std::move(lower), withColor(right->right, Color::BLACK), Color::RED);
+        }
+        return makeNode(l->data, l->left, std::move(right), l->color);
+    }
+
+    static NodePtr joinLeft(const NodePtr& l, const T& key, const NodePtr& r) {
+        if (colorOf(r) == Color::BLACK && blackHeightOf(r) == blackHeightOf(l))
+            return makeNode(key, l, r, Color::RED);
+        NodePtr left = joinLeft(l, key, r->left);
+        if (r->color == Color::BLACK && colorOf(left) == Color::RED && colorOf(left->left) == Color::RED) {
+            NodePtr lower = makeNode(r->data, left->right, r->right, Color::BLACK);
+            return makeNode(left->data, withColor(left->left, Color::BLACK), std::move(lower), Color::RED);
+        }
+        return makeNode(r->data, std::move(left), r->right, r->color);
+    }
+
+    // A valid tree holding l, then key, then r, where every element of l
+    // sorts before key and every element of r after it. The root may end up
+    // red, which is still a valid tree.
+    static NodePtr join(const NodePtr& l, const T& key, const NodePtr& r) {
+        if (blackHeightOf(l) > blackHeightOf(r)) {
+            NodePtr t = joinRight(l, key, r);
+            return t->color == Color::RED && colorOf(t->right) == Color::RED ? withColor(t, Color::BLACK) : t;
+        }
+        if (blackHeightOf(r) > blackHeightOf(l)) {
+            NodePtr t = joinLeft(l, key, r);
+            return t->color == Color::RED && colorOf(t->left) == Color::RED ? withColor(t, Color::BLACK) : t;
+        }
+        Color color = colorOf(l) == Color::BLACK && colorOf(r) == Color::BLACK ? Color::RED : Color::BLACK;
+        return makeNode(key, l, r, color);
+    }
+
+    // Removes the largest element of the non-empty tree t into last.
+    static NodePtr splitLast(const NodePtr& t, const T*& last) {
+        if (!t->right) {
+            last = &t->data;
+            return t->left;
+        }
+        NodePtr right = splitLast(t->right, last);
+        return join(t->left, t->data, right);
+    }
+
+    static NodePtr join(const NodePtr& l, const NodePtr& r) {
+        if (!l)
+            return r;
+        const T* last;
+        NodePtr rest = splitLast(l, last);
+        return join(rest, *last, r);
+    }
+
+    // Both return t itself when nothing changes, so a no-op update copies
+    // no nodes.
+    NodePtr insertInto(const NodePtr& t, const T& value, bool& inserted) const {
+        if (!t) {
+            inserted = true;
+            return makeNode(value, nullptr, nullptr, Color::RED);
+        }
+        auto c = order(value, t->data);
+        if (c < 0) {
+            NodePtr left = insertInto(t->left, value, inserted);
+            return inserted ? join(left, t->data, t->right) : t;
+        }
+        if (c > 0) {
+            NodePtr right = insertInto(t->right, value, inserted);
+            return inserted ? join(t->left, t->data, right) : t;
+        }
+        return t;
+    }
+
+    template <typename K>
+    NodePtr removeFrom(const NodePtr& t, const K& key, bool& removed) const {
+        if (!t)
+            return t;
+        auto c = order(key, t->data);
+        if (c < 0) {
+            NodePtr left = removeFrom(t->left, key, removed);
+            return removed ? join(left, t->data, t->right) : t;
+        }
+        if (c > 0) {
+            NodePtr right = removeFrom(t->right, key, removed);
+            return removed ? join(t->left, t->data, right) : t;
+        }
+        removed = true;
+        return join(t->left, t->right);
+    }
+
+    template <typename K>
+    const Node* findNode(const K& key) const {
+        const Node* x = root.get();
+        while (x) {
+            auto c = order(key, x->data);
+            if (c < 0)
+                x = x->left.get();
+            else if (c > 0)
+                x = x->right.get();
+            else
+                return x;
+        }
+        return nullptr;
+    }
+
+    // Returns the black height, or -1 if the subtree is not a valid
+    // Red-Black subtree with elements strictly between lo and hi.
+    int checkSubtree(const Node* x, const T* lo, const T* hi, std::size_t& seen) const {
+        if (!x)
+            return 0;
+        ++seen;
+        if ((lo && !(order(*lo, x->data) < 0)) || (hi && !(order(x->data, *hi) < 0)))
+            return -1;
+        if (x->color == Color::RED && (colorOf(x->left) == Color::RED || colorOf(x->right) == Color::RED))
+            return -1;
+        int left = checkSubtree(x->left.get(), lo, &x->data, seen);
+        int right = checkSubtree(x->right.get(), &x->data, hi, seen);
+        if (left < 0 || left != right)
+            return -1;
+        int height = left + (x->color == Color::BLACK);
+        return height == x->blackHeight ? height : -1;
+    }
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using key_compare = Compare;
+
+    // In-order iterator. Without parent pointers it carries the path of
+    // ancestors still to be visited, so copying one costs O(log n).
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+
+        reference operator*() const { return path.back()->data; }
+        pointer operator->() const { return &path.back()->data; }
+
+        const_iterator& operator++() {
+            const Node* x = path.back();
+            path.pop_back();
+            descendLeft(x->right.get());
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        friend bool operator==(const const_iterator& a, const const_iterator& b) {
+            return a.path.empty() ? b.path.empty() : !b.path.empty() && a.path.back() == b.path.back();
+        }
+
+    private:
+        friend class PersistentRBTree;
+
+        std::vector<const Node*> path;
+
+        void descendLeft(const Node* x) {
+            for (; x; x = x->left.get())
+                path.push_back(x);
+        }
+    };
+
+    using iterator = const_iterator;
+
+    explicit PersistentRBTree(const Compare& compare = Compare()) : root(nullptr), count(0), comp(compare) {}
+
+    // The version with value added; *this itself if an equivalent element
+    // is already present.
+    [[nodiscard]] PersistentRBTree insert(const T& value) const {
+        bool inserted = false;
+        NodePtr updated = insertInto(root, value, inserted);
+        return PersistentRBTree(std::move(updated), count + inserted, comp);
+    }
+
+    // The version without the element equivalent to key; *this itself if
+    // there is none.
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    [[nodiscard]] PersistentRBTree remove(const K& key) const {
+        bool removed = false;
+        NodePtr updated = removeFrom(root, key, removed);
+        return PersistentRBTree(std::move(updated), count - removed, comp);
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    const T* find(const K& key) const {
+        const Node* x = findNode(key);
+        return x ? &x->data : nullptr;
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    bool contains(const K& key) const {
+        return findNode(key) != nullptr;
+    }
+
+    // First element not less than key.
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    const_iterator lower_bound(const K& key) const {
+        const_iterator it;
+        for (const Node* x = root.get(); x;) {
+            if (order(x->data, key) < 0) {
+                x = x->right.get();
+            } else {
+                it.path.push_back(x);
+                x = x->left.get();
+            }
+        }
+        return it;
+    }
+
+    // Calls fn on every element with a key in [lo, hi), in order.
+    template <typename K, typename F>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    void for_each_in_range(const K& lo, const K& hi, F&& fn) const {
+        for (auto it = lower_bound(lo); it != end() && order(*it, hi) < 0; ++it)
+            fn(*it);
+    }
+
+    const_iterator begin() const {
+        const_iterator it;
+        it.descendLeft(root.get());
+        return it;
+    }
+
+    const_iterator end() const {
+        return const_iterator();
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_type size() const {
+        return count;
+    }
+
+    Compare key_comp() const {
+        return comp;
+    }
+
+    // Whether two versions share the same root, i.e. hold the same nodes.
+    bool same_version(const PersistentRBTree& other) const {
+        return root == other.root;
+    }
+
+    bool isValid() const {
+        std::size_t seen = 0;
+        return checkSubtree(root.get(), nullptr, nullptr, seen) >= 0 && seen == count;
+    }
+};
+
+// The last `capacity` versions of a persistent tree, numbered in commit
+// order, for point-in-time queries. Retaining a version costs only the
+// nodes no later version shares.
+template <typename Tree>
+class VersionHistory {
+public:
+    explicit VersionHistory(std::size_t maxVersions) : capacity(maxVersions ? maxVersions : 1), first(0) {}
+
+    // Records version and returns its number; the oldest version is
+    // dropped once more than capacity are kept.
+    std::size_t commit(Tree version) {
+        versions.push_back(std::move(version));
+        if (versions.size() > capacity) {
+            versions.pop_front();
+            ++first;
+        }
+        return first + versions.size() - 1;
+    }
+
+    // The version numbered `version`, or nullptr if it was dropped or not
+    // committed yet.
+    const Tree* at(std::size_t version) const {
+        if (version < first || version - first >= versions.size())
+            return nullptr;
+        return &versions[version - first];
+    }
+
+    // Requires at least one commit.
+    const Tree& latest() const {
+        return versions.back();
+    }
+
+    std::size_t oldest_version() const {
+        return first;
+    }
+
+    std::size_t size() const {
+        return versions.size();
+    }
+
+private:
+    std::deque<Tree> versions;
+    std::size_t capacity;
+    std::size_t first;
+};
+
+#endif // PERSISTENTRBTREE_H
@@ -0,0 +1,246 @@
+#ifndef RBMAP_H
+#define RBMAP_H
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include "RBTree.h"
+
+// Ordered map from unique keys K to values V, built on the same balancing
+// core as RBTree. Every insertion interface finds the insertion point and
+// any existing entry in a single descent.
+template <typename K, typename V, typename Compare = std::less<>,
+          typename Allocator = std::allocator<std::pair<const K, V>>, typename Augment = NoAugment>
+class RBMap : public RBTreeBase<K, std::pair<const K, V>, SelectFirst, Compare, Allocator, Augment> {
+private:
+    using Base = RBTreeBase<K, std::pair<const K, V>, SelectFirst, Compare, Allocator, Augment>;
+    using typename Base::BasePtr;
+    using typename Base::NodePtr;
+
+public:
+    using mapped_type = V;
+    using typename Base::const_iterator;
+    using typename Base::iterator;
+    using typename Base::value_type;
+
+private:
+    // Builds a node from args only when key is not present yet.
+    template <typename Key, typename... Args>
+    std::pair<iterator, bool> emplaceUnique(const Key& key, Args&&... args) {
+        BasePtr parent;
+        bool asLeft;
+        if (NodePtr existing = this->uniqueInsertParent(key, parent, asLeft))
+            return {this->makeIterator(existing), false};
+        NodePtr z = this->createNode(std::forward<Args>(args)...);
+        this->linkNode(z, parent, asLeft);
+        return {this->makeIterator(z), true};
+    }
+
+    // As emplaceUnique, but tries the slot before hint first.
+    template <typename Key, typename... Args>
+    iterator emplaceUniqueNear(const_iterator hint, const Key& key, Args&&... args) {
+        BasePtr parent;
+        bool asLeft;
+        NodePtr existing;
+        if (!this->hintedInsertParent(this->nodeOf(hint), key, true, parent, asLeft, existing))
+            existing = this->uniqueInsertParent(key, parent, asLeft);
+        if (existing)
+            return this->makeIterator(existing);
+        NodePtr z = this->createNode(std::forward<Args>(args)...);
+        this->linkNode(z, parent, asLeft);
+        return this->makeIterator(z);
+    }
+
+    template <typename Key, typename M>
+    std::pair<iterator, bool> assignUnique(Key&& key, M&& obj) {
+        BasePtr parent;
+        bool asLeft;
+        if (NodePtr existing = this->uniqueInsertParent(key, parent, asLeft)) {
+            existing->data.second = std::forward<M>(obj);
+            this->pullUpToRoot(existing);
+            return {this->makeIterator(existing), false};
+        }
+        NodePtr z = this->createNode(std::forward<Key>(key), std::forward<M>(obj));
+        this->linkNode(z, parent, asLeft);
+        return {this->makeIterator(z), true};
+    }
+
+public:
+    using Base::Base;
+
+    // Builds a perfectly balanced map from input with strictly increasing
+    // keys in O(n) without comparing keys; verify adds one O(n) check that
+    // throws std::invalid_argument otherwise.
+    template <std::input_iterator It>
+    static RBMap from_sorted(It first, It last, bool verify = false, const Compare& compare = Compare(),
+                             const Allocator& allocator = Allocator()) {
+        RBMap map(compare, allocator);
+        map.buildFromSorted(first, last, verify, true);
+        return map;
+    }
+
+    // Sorts the input first; for duplicate keys the first occurrence wins.
+    template <std::input_iterator It>
+    static RBMap from_unsorted(It first, It last, const Compare& compare = Compare(),
+                               const Allocator& allocator = Allocator()) {
+        RBMap map(compare, allocator);
+        map.buildFromUnsorted(first, last, true);
+        return map;
+    }
+
+    // Sorts and links across par's pool.
+    template <std::input_iterator It>
+    static RBMap from_unsorted(It first, It last, const Parallelism& par, const Compare& compare = Compare(),
+                               const Allocator& allocator = Allocator()) {
+        RBMap map(compare, allocator);
+        map.buildFromUnsorted(first, last, true, &par);
+        return map;
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return emplaceUnique(value.first, value);
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value) {
+        return emplaceUnique(value.first, std::move(value));
+    }
+
+    // Amortized O(1) when the key belongs right before hint; returns the
+    // entry holding the key, whether or not it was inserted.
+    iterator insert(const_iterator hint, const value_type& value) {
+        return emplaceUniqueNear(hint, value.first, value);
+    }
+
+    iterator insert(const_iterator hint, value_type&& value) {
+        return emplaceUniqueNear(hint, value.first, std::move(value));
+    }
+
+    // The pair has to be built before its key can be compared; the node is
+    // released again if the key is already present.
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        NodePtr z = this->createNode(std::forward<Args>(args)...);
+        BasePtr parent;
+        bool asLeft;
+        if (NodePtr existing = this->uniqueInsertParent(z->data.first, parent, asLeft)) {
+            this->destroyNode(z);
+            return {this->makeIterator(existing), false};
+        }
+        this->linkNode(z, parent, asLeft);
+        return {this->makeIterator(z), true};
+    }
+
+    template <typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args) {
+        NodePtr z = this->createNode(std::forward<Args>(args)...);
+        BasePtr parent;
+        bool asLeft;
+        NodePtr existing;
+        if (!this->hintedInsertParent(this->nodeOf(hint), z->data.first, true, parent, asLeft, existing))
+            existing = this->uniqueInsertParent(z->data.first, parent, asLeft);
+        if (existing) {
+            this->destroyNode(z);
+            return this->makeIterator(existing);
+        }
+        this->linkNode(z, parent, asLeft);
+        return this->makeIterator(z);
+    }
+
+    // Neither the key nor args are touched when the key is already present.
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const K& key, Args&&... args) {
+        return emplaceUnique(key, std::piecewise_construct, std::forward_as_tuple(key),
+                             std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) {
+        return emplaceUnique(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                             std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const K& key, M&& obj) {
+        return assignUnique(key, std::forward<M>(obj));
+    }
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(K&& key, M&& obj) {
+        return assignUnique(std::move(key), std::forward<M>(obj));
+    }
+
+    // With an aggregate over mapped values, only const access to them is
+    // given out, so operator[] and the non-const at() are unavailable;
+    // write through assign or insert_or_assign instead.
+    V& operator[](const K& key)
+        requires(!Base::readOnlyValues)
+    {
+        return try_emplace(key).first->second;
+    }
+
+    V& operator[](K&& key)
+        requires(!Base::readOnlyValues)
+    {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    V& at(const K& key)
+        requires(!Base::readOnlyValues)
+    {
+        NodePtr node = this->findNode(key);
+        if (!node)
+            throw std::out_of_range("RBMap::at: key not found");
+        return node->data.second;
+    }
+
+    const V& at(const K& key) const {
+        NodePtr node = this->findNode(key);
+        if (!node)
+            throw std::out_of_range("RBMap::at: key not found");
+        return node->data.second;
+    }
+
+    // Replaces the mapped value at pos and updates the aggregates above it
+    // in O(log n).
+    template <typename M>
+    iterator assign(const_iterator pos, M&& obj) {
+        NodePtr node = this->asNode(this->nodeOf(pos));
+        node->data.second = std::forward<M>(obj);
+        this->pullUpToRoot(node);
+        return this->makeIterator(node);
+    }
+
+    // Moves all of right's entries to the end of this map in O(log n). Every
+    // key in right must sort after the largest key here; otherwise throws
+    // std::invalid_argument and leaves both maps unchanged.
+    void join(RBMap&& right) {
+        this->joinWith(right, true);
+    }
+
+    // Moves the entries with keys not less than key into the returned map,
+    // in O(log n); sizes are recounted lazily as for RBTree::split.
+    RBMap split(const K& key) {
+        RBMap right(this->key_comp(), this->get_allocator());
+        this->splitInto(key, right);
+        return right;
+    }
+
+    // Set operations by key that consume other, in O(m log(n/m + 1)) as for
+    // RBTree. Where both maps hold a key, this map's entry is kept.
+    void union_with(RBMap&& other) {
+        this->uniteWith(other, true);
+    }
+
+    void intersect_with(RBMap&& other) {
+        this->intersectWith(other);
+    }
+
+    void difference_with(RBMap&& other) {
+        this->subtractWith(other);
+    }
+};
+
+#endif // RBMAP_H
@@ -1,281 +1,2500 @@
 #ifndef RBTREE_H
 #define RBTREE_H
 
+#include <algorithm>
+#include <bit>
+#include <compare>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-enum class Color { RED, BLACK };
+#include "Augment.h"
+#include "Color.h"
+#include "Compare.h"
+#include "Parallel.h"
 
-template <typename T>
-class RBTree {
-private:
-    struct Node {
-        T data;
-        Color color;
-        std::shared_ptr<Node> left, right, parent;
+// Extracts the key from a stored value: the value itself for sets, the first
+// member of the pair for maps.
+struct IdentityKey {
+    template <typename U>
+    const U& operator()(const U& value) const { return value; }
+};
+
+struct SelectFirst {
+    template <typename Pair>
+    const auto& operator()(const Pair& value) const { return value.first; }
+};
+
+// Balancing core shared by RBTree (RBSet) and RBMap. It stores Values,
+// orders them by the Key that KeyOfValue extracts, and owns allocation,
+// rotations, both fixups, transplant and the keyed descents. The derived
+// containers only add their insertion interfaces.
+//
+// The tree hangs off a header sentinel: the root is the header's left child
+// and the header is the root's parent. The header doubles as end(), so
+// in-order successor and predecessor walks need no special cases, and
+// rotations at the root update the header like any other parent.
+template <typename Key, typename Value, typename KeyOfValue, typename Compare, typename Allocator,
+          typename Augment = NoAugment>
+class RBTreeBase {
+protected:
+    // Nodes are at least pointer-aligned, so the low bit of the parent
+    // address is always zero and carries the color instead of a separate,
+    // padded Color field. Go through parentOf/colorOf and their setters.
+    struct NodeBase {
+        NodeBase *left, *right;
+        std::uintptr_t parentColor;
+
+        NodeBase() : left(nullptr), right(nullptr), parentColor(0) {}
+    };
+
+    static constexpr bool hasAggregate = AugmentPolicy<Augment, Value>;
+    static constexpr bool hasSizes = std::is_same_v<Augment, OrderStatistics>;
+    static constexpr bool hasIntervals = std::is_same_v<Augment, IntervalOverlap>;
+
+    // Set elements are immutable, and so are mapped values when the
+    // aggregate may read them: a change in place would leave the
+    // ancestors' aggregates stale. The size and interval policies only
+    // read keys.
+    static constexpr bool readOnlyValues =
+        std::is_same_v<Key, Value> || (hasAggregate && !hasSizes && !hasIntervals);
+
+    struct NoAggregate {};
+
+    template <typename A>
+    struct AggregateType {
+        using type = NoAggregate;
+    };
+
+    template <typename A>
+        requires AugmentPolicy<A, Value>
+    struct AggregateType<A> {
+        using type = AggregateOf<A, Value>;
+    };
+
+    using Aggregate = typename AggregateType<Augment>::type;
+
+    // Without a policy the aggregate is an empty type that takes no space.
+    struct Node : NodeBase {
+        [[no_unique_address]] Aggregate aggregate;
+        Value data;
 
-        explicit Node(T data)
-            : data(data), color(Color::RED), left(nullptr), right(nullptr), parent(nullptr) {}
+        template <typename... Args>
+        explicit Node(Args&&... args) : data(std::forward<Args>(args)...) {
+            this->parentColor = redBit;
+        }
     };
 
-    using NodePtr = std::shared_ptr<Node>;
+    static constexpr std::uintptr_t redBit = 1;
+
+    // The tree owns every node; links are plain pointers, so walking and
+    // rebalancing the tree never touches a reference count.
+    using BasePtr = NodeBase*;
+    using NodePtr = Node*;
+    using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAllocator>;
+
+    [[no_unique_address]] Compare comp;
+    [[no_unique_address]] NodeAllocator alloc;
+    // The root hangs off header.left; header.right caches the largest node
+    // (null when empty), so end() steps back to it in O(1) and appends in
+    // ascending key order skip the descent.
+    NodeBase header;
+    // Smallest node, or the header when the tree is empty.
+    BasePtr leftmost;
+    // Number of elements, or unknownCount after a split that had no
+    // subtree sizes to read the halves' sizes from. size() then counts
+    // once and caches the result.
+    mutable std::size_t nodeCount;
+
+    static constexpr std::size_t unknownCount = std::size_t(-1);
+
+    // Count arithmetic that keeps an unknown count unknown.
+    static std::size_t addCount(std::size_t count, std::size_t n) {
+        return count == unknownCount || n == unknownCount ? unknownCount : count + n;
+    }
+
+    static std::size_t subtractCount(std::size_t count, std::size_t n) {
+        return count == unknownCount ? unknownCount : count - n;
+    }
+
+    BasePtr root() const {
+        return header.left;
+    }
+
+    BasePtr headerPtr() const {
+        return const_cast<BasePtr>(&header);
+    }
+
+    BasePtr rightmost() const {
+        return header.right;
+    }
+
+    static NodePtr asNode(BasePtr x) {
+        return static_cast<NodePtr>(x);
+    }
+
+    static std::size_t sizeOf(BasePtr x)
+        requires hasSizes
+    {
+        return x ? asNode(x)->aggregate : 0;
+    }
+
+    static const Aggregate& aggregateAt(BasePtr x)
+        requires hasAggregate
+    {
+        return asNode(x)->aggregate;
+    }
+
+    // x's aggregate recomputed from its element and its children's stored
+    // aggregates, combined in key order.
+    static Aggregate combineAt(BasePtr x)
+        requires hasAggregate
+    {
+        Aggregate result = Augment::lift(asNode(x)->data);
+        if (x->left)
+            result = Augment::combine(aggregateAt(x->left), result);
+        if (x->right)
+            result = Augment::combine(result, aggregateAt(x->right));
+        return result;
+    }
+
+    // Recomputes x's aggregate from its children, which must already be up
+    // to date. A no-op without augmentation.
+    static void pullUp(BasePtr x) {
+        if constexpr (hasAggregate)
+            asNode(x)->aggregate = combineAt(x);
+    }
+
+    // Refreshes x and every ancestor after x's subtree changed.
+    static void pullUpToRoot(BasePtr x) {
+        if constexpr (hasAggregate) {
+            for (; parentOf(x); x = parentOf(x))
+                pullUp(x);
+        }
+    }
+
+    static const Key& keyOf(const Value& value) {
+        return KeyOfValue()(value);
+    }
+
+    static const Key& keyOf(BasePtr x) {
+        return keyOf(asNode(x)->data);
+    }
+
+    template <typename A, typename B>
+    bool less(const A& a, const B& b) const {
+        return compareLess(comp, a, b);
+    }
+
+    template <typename A, typename B>
+    std::partial_ordering order(const A& a, const B& b) const {
+        return compareOrder(comp, a, b);
+    }
+
+    static BasePtr parentOf(BasePtr x) {
+        return reinterpret_cast<BasePtr>(x->parentColor & ~redBit);
+    }
+
+    static void setParent(BasePtr x, BasePtr p) {
+        x->parentColor = reinterpret_cast<std::uintptr_t>(p) | (x->parentColor & redBit);
+    }
+
+    // Empty leaves and the header count as black.
+    static Color colorOf(BasePtr x) {
+        return x && (x->parentColor & redBit) ? Color::RED : Color::BLACK;
+    }
+
+    static void setColor(BasePtr x, Color color) {
+        if (color == Color::RED)
+            x->parentColor |= redBit;
+        else
+            x->parentColor &= ~redBit;
+    }
+
+    static BasePtr minimum(BasePtr node) {
+        while (node->left)
+            node = node->left;
+        return node;
+    }
+
+    static BasePtr maximum(BasePtr node) {
+        while (node->right)
+            node = node->right;
+        return node;
+    }
+
+    // In-order neighbours. Stepping past the largest element climbs to the
+    // header (the root is its left child, whatever header.right caches), and
+    // stepping back from the header, the only parentless node, reads the
+    // cached largest node.
+    static BasePtr successor(BasePtr x) {
+        if (x->right)
+            return minimum(x->right);
+        BasePtr p = parentOf(x);
+        while (x != p->left) {
+            x = p;
+            p = parentOf(p);
+        }
+        return p;
+    }
+
+    static BasePtr predecessor(BasePtr x) {
+        if (!parentOf(x))
+            return x->right;
+        if (x->left)
+            return maximum(x->left);
+        BasePtr p = parentOf(x);
+        while (x == p->left) {
+            x = p;
+            p = parentOf(p);
+        }
+        return p;
+    }
+
+    template <typename... Args>
+    NodePtr createNode(Args&&... args) {
+        NodePtr node = NodeTraits::allocate(alloc, 1);
+        try {
+            NodeTraits::construct(alloc, node, std::forward<Args>(args)...);
+        } catch (...) {
+            NodeTraits::deallocate(alloc, node, 1);
+            throw;
+        }
+        return node;
+    }
+
+    void destroyNode(BasePtr node) {
+        NodeTraits::destroy(alloc, asNode(node));
+        NodeTraits::deallocate(alloc, asNode(node), 1);
+    }
+
+    // Links each copy into place before descending, so a throwing copy still
+    // leaves a well-formed tree that cloneFrom can free.
+    void cloneInto(BasePtr& slot, BasePtr node, BasePtr parent) {
+        if (!node)
+            return;
+        slot = createNode(asNode(node)->data);
+        setColor(slot, colorOf(node));
+        setParent(slot, parent);
+        cloneInto(slot->left, node->left, slot);
+        cloneInto(slot->right, node->right, slot);
+        pullUp(slot);
+    }
+
+    void cloneFrom(const RBTreeBase& other) {
+        try {
+            cloneInto(header.left, other.root(), &header);
+        } catch (...) {
+            clear();
+            throw;
+        }
+        resetExtremes(other.nodeCount);
+    }
+
+    // Takes over other's nodes; both trees must share an allocator.
+    void stealFrom(RBTreeBase& other) {
+        header.left = other.header.left;
+        if (header.left)
+            setParent(header.left, &header);
+        other.header.left = nullptr;
+        resetExtremes(other.nodeCount);
+        other.resetExtremes(0);
+    }
+
+    // Recomputes the cached extremes after the tree was replaced wholesale.
+    void resetExtremes(std::size_t size) {
+        BasePtr top = root();
+        leftmost = top ? minimum(top) : &header;
+        header.right = top ? maximum(top) : nullptr;
+        nodeCount = size;
+    }
 
-    NodePtr root;
+    // Frees a subtree bottom-up by following parent links, so teardown needs
+    // neither recursion nor an auxiliary stack. Returns the number of nodes
+    // freed.
+    std::size_t destroy(BasePtr node) {
+        std::size_t freed = 0;
+        BasePtr top = node ? parentOf(node) : nullptr;
+        while (node != top) {
+            if (node->left) {
+                node = node->left;
+            } else if (node->right) {
+                node = node->right;
+            } else {
+                BasePtr parent = parentOf(node);
+                if (parent != top) {
+                    if (parent->left == node)
+                        parent->left = nullptr;
+                    else
+                        parent->right = nullptr;
+                }
+                destroyNode(node);
+                ++freed;
+                node = parent;
+            }
+        }
+        return freed;
+    }
 
-    void leftRotate(NodePtr x) {
-        NodePtr y = x->right;
+    // The root is the header's left child, so rotating it needs no special
+    // case: the header is updated like any other parent. The left link is
+    // tested first because header.right may point at the root too. Only x
+    // and y change subtrees, so refreshing them (x first, as it is now y's
+    // child) keeps augmented data correct in O(1).
+    void leftRotate(BasePtr x) {
+        BasePtr y = x->right;
+        BasePtr p = parentOf(x);
         x->right = y->left;
         if (y->left)
-            y->left->parent = x;
-        y->parent = x->parent;
-        if (!x->parent)
-            root = y;
-        else if (x == x->parent->left)
-            x->parent->left = y;
+            setParent(y->left, x);
+        setParent(y, p);
+        if (x == p->left)
+            p->left = y;
         else
-            x->parent->right = y;
+            p->right = y;
         y->left = x;
-        x->parent = y;
+        setParent(x, y);
+        pullUp(x);
+        pullUp(y);
     }
 
-    void rightRotate(NodePtr x) {
-        NodePtr y = x->left;
+    void rightRotate(BasePtr x) {
+        BasePtr y = x->left;
+        BasePtr p = parentOf(x);
         x->left = y->right;
         if (y->right)
-            y->right->parent = x;
-        y->parent = x->parent;
-        if (!x->parent)
-            root = y;
-        else if (x == x->parent->right)
-            x->parent->right = y;
+            setParent(y->right, x);
+        setParent(y, p);
+        if (x == p->left)
+            p->left = y;
         else
-            x->parent->left = y;
+            p->right = y;
         y->right = x;
-        x->parent = y;
-    }
-
-    void insertFixup(NodePtr z) {
-        while (z->parent && z->parent->color == Color::RED) {
-            if (z->parent == z->parent->parent->left) {
-                NodePtr y = z->parent->parent->right;
-                if (y && y->color == Color::RED) {
-                    z->parent->color = Color::BLACK;
-                    y->color = Color::BLACK;
-                    z->parent->parent->color = Color::RED;
-                    z = z->parent->parent;
+        setParent(x, y);
+        pullUp(x);
+        pullUp(y);
+    }
+
+    void insertFixup(BasePtr z) {
+        rebalanceInsert(z);
+        setColor(root(), Color::BLACK);
+    }
+
+    // Resolves a red z under a red parent. The header is black, so the loop
+    // stops at the root, which may be left red.
+    void rebalanceInsert(BasePtr z) {
+        BasePtr p;
+        while (colorOf(p = parentOf(z)) == Color::RED) {
+            BasePtr g = parentOf(p);
+            if (p == g->left) {
+                BasePtr y = g->right;
+                if (colorOf(y) == Color::RED) {
+                    setColor(p, Color::BLACK);
+                    setColor(y, Color::BLACK);
+                    setColor(g, Color::RED);
+                    z = g;
                 } else {
-                    if (z == z->parent->right) {
-                        z = z->parent;
+                    if (z == p->right) {
+                        z = p;
                         leftRotate(z);
+                        p = parentOf(z);
                     }
-                    z->parent->color = Color::BLACK;
-                    z->parent->parent->color = Color::RED;
-                    rightRotate(z->parent->parent);
+                    setColor(p, Color::BLACK);
+                    setColor(g, Color::RED);
+                    rightRotate(g);
                 }
             } else {
-                NodePtr y = z->parent->parent->left;
-                if (y && y->color == Color::RED) {
-                    z->parent->color = Color::BLACK;
-                    y->color = Color::BLACK;
-                    z->parent->parent->color = Color::RED;
-                    z = z->parent->parent;
+                BasePtr y = g->left;
+                if (colorOf(y) == Color::RED) {
+                    setColor(p, Color::BLACK);
+                    setColor(y, Color::BLACK);
+                    setColor(g, Color::RED);
+                    z = g;
                 } else {
-                    if (z == z->parent->left) {
-                        z = z->parent;
+                    if (z == p->left) {
+                        z = p;
                         rightRotate(z);
+                        p = parentOf(z);
                     }
-                    z->parent->color = Color::BLACK;
-                    z->parent->parent->color = Color::RED;
-                    leftRotate(z->parent->parent);
+                    setColor(p, Color::BLACK);
+                    setColor(g, Color::RED);
+                    leftRotate(g);
                 }
             }
         }
-        root->color = Color::BLACK;
     }
 
-    void transplant(NodePtr u, NodePtr v) {
-        if (!u->parent)
-            root = v;
-        else if (u == u->parent->left)
-            u->parent->left = v;
+    void transplant(BasePtr u, BasePtr v) {
+        BasePtr p = parentOf(u);
+        if (u == p->left)
+            p->left = v;
         else
-            u->parent->right = v;
+            p->right = v;
         if (v)
-            v->parent = u->parent;
-    }
-
-    void removeFixup(NodePtr x) {
-        while (x != root && (!x || x->color == Color::BLACK)) {
-            if (x == x->parent->left) {
-                NodePtr w = x->parent->right;
-                if (w->color == Color::RED) {
-                    w->color = Color::BLACK;
-                    x->parent->color = Color::RED;
-                    leftRotate(x->parent);
-                    w = x->parent->right;
+            setParent(v, p);
+    }
+
+    // x may be null (an empty leaf), so its parent is tracked separately.
+    void removeFixup(BasePtr x, BasePtr xParent) {
+        while (x != root() && colorOf(x) == Color::BLACK) {
+            if (x == xParent->left) {
+                BasePtr w = xParent->right;
+                if (colorOf(w) == Color::RED) {
+                    setColor(w, Color::BLACK);
+                    setColor(xParent, Color::RED);
+                    leftRotate(xParent);
+                    w = xParent->right;
                 }
-                if ((!w->left || w->left->color == Color::BLACK) &&
-                    (!w->right || w->right->color == Color::BLACK)) {
-                    w->color = Color::RED;
-                    x = x->parent;
+                if (colorOf(w->left) == Color::BLACK && colorOf(w->right) == Color::BLACK) {
+                    setColor(w, Color::RED);
+                    x = xParent;
+                    xParent = parentOf(x);
                 } else {
-                    if (!w->right || w->right->color == Color::BLACK) {
-                        if (w->left)
-                            w->left->color = Color::BLACK;
-                        w->color = Color::RED;
+                    if (colorOf(w->right) == Color::BLACK) {
+                        setColor(w->left, Color::BLACK);
+                        setColor(w, Color::RED);
                         rightRotate(w);
-                        w = x->parent->right;
+                        w = xParent->right;
                     }
-                    w->color = x->parent->color;
-                    x->parent->color = Color::BLACK;
+                    setColor(w, colorOf(xParent));
+                    setColor(xParent, Color::BLACK);
                     if (w->right)
-                        w->right->color = Color::BLACK;
-                    leftRotate(x->parent);
-                    x = root;
+                        setColor(w->right, Color::BLACK);
+                    leftRotate(xParent);
+                    x = root();
                 }
             } else {
-                NodePtr w = x->parent->left;
-                if (w->color == Color::RED) {
-                    w->color = Color::BLACK;
-                    x->parent->color = Color::RED;
-                    rightRotate(x->parent);
-                    w = x->parent->left;
+                BasePtr w = xParent->left;
+                if (colorOf(w) == Color::RED) {
+                    setColor(w, Color::BLACK);
+                    setColor(xParent, Color::RED);
+                    rightRotate(xParent);
+                    w = xParent->left;
                 }
-                if ((!w->left || w->left->color == Color::BLACK) &&
-                    (!w->right || w->right->color == Color::BLACK)) {
-                    w->color = Color::RED;
-                    x = x->parent;
+                if (colorOf(w->left) == Color::BLACK && colorOf(w->right) == Color::BLACK) {
+                    setColor(w, Color::RED);
+                    x = xParent;
+                    xParent = parentOf(x);
                 } else {
-                    if (!w->left || w->left->color == Color::BLACK) {
-                        if (w->right)
-                            w->right->color = Color::BLACK;
-                        w->color = Color::RED;
+                    if (colorOf(w->left) == Color::BLACK) {
+                        setColor(w->right, Color::BLACK);
+                        setColor(w, Color::RED);
                         leftRotate(w);
-                        w = x->parent->left;
+                        w = xParent->left;
                     }
-                    w->color = x->parent->color;
-                    x->parent->color = Color::BLACK;
+                    setColor(w, colorOf(xParent));
+                    setColor(xParent, Color::BLACK);
                     if (w->left)
-                        w->left->color = Color::BLACK;
-                    rightRotate(x->parent);
-                    x = root;
+                        setColor(w->left, Color::BLACK);
+                    rightRotate(xParent);
+                    x = root();
                 }
             }
         }
         if (x)
-            x->color = Color::BLACK;
-    }
-
-    NodePtr minimum(NodePtr node) const {
-        while (node->left)
-            node = node->left;
-        return node;
+            setColor(x, Color::BLACK);
     }
 
-    void remove(NodePtr z) {
-        NodePtr y = z;
-        NodePtr x;
-        Color originalColor = y->color;
+    void removeNode(BasePtr z) {
+        // An extreme node has no child on its outer side, so its inner
+        // neighbour tops the other subtree or else is its parent; a childless
+        // root leaves the tree empty.
+        if (z == leftmost)
+            leftmost = z->right ? minimum(z->right) : parentOf(z);
+        if (z == rightmost()) {
+            BasePtr p = z->left ? maximum(z->left) : parentOf(z);
+            header.right = p == &header ? nullptr : p;
+        }
+        nodeCount = subtractCount(nodeCount, 1);
+        BasePtr y = z;
+        BasePtr x;
+        BasePtr xParent;
+        Color originalColor = colorOf(y);
         if (!z->left) {
             x = z->right;
+            xParent = parentOf(z);
             transplant(z, z->right);
         } else if (!z->right) {
             x = z->left;
+            xParent = parentOf(z);
             transplant(z, z->left);
         } else {
             y = minimum(z->right);
-            originalColor = y->color;
+            originalColor = colorOf(y);
             x = y->right;
-            if (y->parent == z) {
+            if (parentOf(y) == z) {
+                xParent = y;
                 if (x)
-                    x->parent = y;
+                    setParent(x, y);
             } else {
+                xParent = parentOf(y);
                 transplant(y, y->right);
                 y->right = z->right;
-                y->right->parent = y;
+                setParent(y->right, y);
             }
             transplant(z, y);
             y->left = z->left;
-            y->left->parent = y;
-            y->color = z->color;
+            setParent(y->left, y);
+            setColor(y, colorOf(z));
         }
+        // Every subtree that lost a node lies on the path from xParent up,
+        // which passes through y when it replaced z.
+        pullUpToRoot(xParent);
         if (originalColor == Color::BLACK)
-            removeFixup(x);
+            removeFixup(x, xParent);
+        destroyNode(z);
     }
 
-public:
-    RBTree() : root(nullptr) {}
+    // Black height of the subtree at node, or -1 if the subtree breaks an
+    // ordering, coloring or parent-link invariant.
+    int checkSubtree(BasePtr node, BasePtr parent) const {
+        if (!node)
+            return 0;
+        if (parentOf(node) != parent)
+            return -1;
+        if (colorOf(node) == Color::RED && colorOf(parent) == Color::RED)
+            return -1;
+        if ((node->left && less(keyOf(node), keyOf(node->left))) ||
+            (node->right && less(keyOf(node->right), keyOf(node))))
+            return -1;
+        int left = checkSubtree(node->left, node);
+        int right = checkSubtree(node->right, node);
+        if (left < 0 || left != right)
+            return -1;
+        if constexpr (hasAggregate && std::equality_comparable<Aggregate>) {
+            if (!(aggregateAt(node) == combineAt(node)))
+                return -1;
+        }
+        return left + (colorOf(node) == Color::BLACK ? 1 : 0);
+    }
+
+    template <typename K>
+    NodePtr findNode(const K& key) const {
+        BasePtr node = root();
+        while (node) {
+            std::partial_ordering cmp = order(key, keyOf(node));
+            if (cmp < 0)
+                node = node->left;
+            else if (cmp > 0)
+                node = node->right;
+            else
+                return asNode(node);
+        }
+        return nullptr;
+    }
+
+    // Calls found(i, findNode(keys[i])) for i in [0, n), keeping findManyGroup
+    // descents in flight. Each round takes every descent one level down and
+    // prefetches the child it moves to, so the cache misses of the group
+    // overlap instead of each lookup stalling on its own. A finished
+    // descent hands its slot to the next key. 32 keeps the core's miss
+    // queue full on trees far larger than the cache; 8 and 16 fell short.
+    static constexpr std::size_t findManyGroup = 32;
+
+    template <typename K, typename F>
+    void findManyNodes(const K* keys, std::size_t n, F&& found) const {
+        struct Lookup {
+            std::size_t index;
+            BasePtr node;
+        };
+        Lookup lookups[findManyGroup];
+        std::size_t active = 0;
+        std::size_t next = 0;
+        if (!root()) {
+            for (std::size_t i = 0; i < n; ++i)
+                found(i, NodePtr());
+            return;
+        }
+        while (active < findManyGroup && next < n)
+            lookups[active++] = {next++, root()};
+        while (active > 0) {
+            for (std::size_t i = 0; i < active;) {
+                Lookup& lookup = lookups[i];
+                std::partial_ordering cmp = order(keys[lookup.index], keyOf(lookup.node));
+                BasePtr child = cmp < 0 ? lookup.node->left : lookup.node->right;
+                if (cmp != 0 && child) {
+                    __builtin_prefetch(child);
+                    lookup.node = child;
+                    ++i;
+                    continue;
+                }
+                found(lookup.index, cmp == 0 ? asNode(lookup.node) : nullptr);
+                if (next < n)
+                    lookup = {next++, root()};
+                else
+                    lookup = lookups[--active];
+            }
+        }
+    }
+
+    // Sets out[i] to upperBoundNode(keyAt(i)) for i in [0, n), with the
+    // descents interleaved as in findManyNodes.
+    template <typename KeyAt>
+    void upperBoundNodes(std::size_t n, const KeyAt& keyAt, BasePtr* out) const {
+        struct Descent {
+            std::size_t index;
+            BasePtr node;
+            BasePtr result;
+        };
+        Descent descents[findManyGroup];
+        std::size_t active = 0;
+        std::size_t next = 0;
+        BasePtr head = headerPtr();
+        if (!root()) {
+            std::fill(out, out + n, head);
+            return;
+        }
+        while (active < findManyGroup && next < n)
+            descents[active++] = {next++, root(), head};
+        while (active > 0) {
+            for (std::size_t i = 0; i < active;) {
+                Descent& descent = descents[i];
+                bool left = less(keyAt(descent.index), keyOf(descent.node));
+                if (left)
+                    descent.result = descent.node;
+                BasePtr child = left ? descent.node->left : descent.node->right;
+                if (child) {
+                    __builtin_prefetch(child);
+                    descent.node = child;
+                    ++i;
+                    continue;
+                }
+                out[descent.index] = descent.result;
+                if (next < n)
+                    descent = {next++, root(), head};
+                else
+                    descent = descents[--active];
+            }
+        }
+    }
 
-    void insert(T data) {
-        NodePtr z = std::make_shared<Node>(data);
-        NodePtr y = nullptr;
-        NodePtr x = root;
+    // Equal keys may sit on both sides of the first match found.
+    template <typename K>
+    std::size_t countEqual(BasePtr node, const K& key) const {
+        if (!node)
+            return 0;
+        std::partial_ordering cmp = order(key, keyOf(node));
+        if (cmp < 0)
+            return countEqual(node->left, key);
+        if (cmp > 0)
+            return countEqual(node->right, key);
+        return 1 + countEqual(node->left, key) + countEqual(node->right, key);
+    }
 
+    // Number of elements whose key is less than key: every left subtree
+    // passed over on the way down counts whole.
+    template <typename K>
+    std::size_t rankOf(const K& key) const
+        requires hasSizes
+    {
+        std::size_t rank = 0;
+        BasePtr x = root();
         while (x) {
-            y = x;
-            if (z->data < x->data)
+            if (less(keyOf(x), key)) {
+                rank += sizeOf(x->left) + 1;
+                x = x->right;
+            } else {
                 x = x->left;
-            else
+            }
+        }
+        return rank;
+    }
+
+    // The node at 0-based in-order position k, or the header if k is out
+    // of range.
+    BasePtr selectNode(std::size_t k) const
+        requires hasSizes
+    {
+        BasePtr x = root();
+        while (x) {
+            std::size_t left = sizeOf(x->left);
+            if (k == left)
+                return x;
+            if (k < left) {
+                x = x->left;
+            } else {
+                k -= left + 1;
                 x = x->right;
+            }
         }
+        return headerPtr();
+    }
 
-        z->parent = y;
-        if (!y)
-            root = z;
-        else if (z->data < y->data)
-            y->left = z;
-        else
-            y->right = z;
+    template <typename K>
+    std::size_t countBetween(const K& lo, const K& hi) const
+        requires hasSizes
+    {
+        if (!less(lo, hi))
+            return 0;
+        return rankOf(hi) - rankOf(lo);
+    }
 
-        insertFixup(z);
+    // Folds the elements of subtree x whose key is not less than lo. Each
+    // step down to the left prepends the node and its whole right subtree.
+    template <typename K>
+    void foldFrom(BasePtr x, const K& lo, std::optional<Aggregate>& result) const
+        requires hasAggregate
+    {
+        while (x) {
+            if (!less(keyOf(x), lo)) {
+                Aggregate part = Augment::lift(asNode(x)->data);
+                if (x->right)
+                    part = Augment::combine(part, aggregateAt(x->right));
+                result = result ? Augment::combine(part, *result) : std::move(part);
+                x = x->left;
+            } else {
+                x = x->right;
+            }
+        }
     }
 
-    void remove(T data) {
-        NodePtr z = root;
-        while (z) {
-            if (z->data == data) {
-                remove(z);
-                return;
+    // Mirror image of foldFrom for the elements whose key is less than hi.
+    template <typename K>
+    void foldBefore(BasePtr x, const K& hi, std::optional<Aggregate>& result) const
+        requires hasAggregate
+    {
+        while (x) {
+            if (less(keyOf(x), hi)) {
+                Aggregate part = Augment::lift(asNode(x)->data);
+                if (x->left)
+                    part = Augment::combine(aggregateAt(x->left), part);
+                result = result ? Augment::combine(*result, part) : std::move(part);
+                x = x->right;
+            } else {
+                x = x->left;
             }
-            if (data < z->data)
-                z = z->left;
-            else
-                z = z->right;
         }
     }
 
-    NodePtr search(T data) const {
-        NodePtr node = root;
-        while (node && node->data != data) {
-            if (data < node->data)
-                node = node->left;
+    // Aggregate of the elements with keys in [lo, hi): descends to the
+    // first node inside the range, then folds the two boundary paths below
+    // it, using stored aggregates for every subtree wholly inside.
+    template <typename K>
+    std::optional<Aggregate> aggregateRange(const K& lo, const K& hi) const
+        requires hasAggregate
+    {
+        BasePtr x = root();
+        while (x) {
+            if (less(keyOf(x), lo))
+                x = x->right;
+            else if (!less(keyOf(x), hi))
+                x = x->left;
             else
-                node = node->right;
+                break;
         }
-        return node;
+        if (!x)
+            return std::nullopt;
+        std::optional<Aggregate> result;
+        foldFrom(x->left, lo, result);
+        result = result ? Augment::combine(*result, Augment::lift(asNode(x)->data)) : Augment::lift(asNode(x)->data);
+        foldBefore(x->right, hi, result);
+        return result;
     }
 
-    void print(NodePtr node, std::string indent, bool last) const {
-        if (node) {
-            std::cout << indent;
-            if (last) {
-                std::cout << "R----";
-                indent += "   ";
-            } else {
-                std::cout << "L----";
-                indent += "|  ";
+    // First node in order whose interval overlaps [lo, hi], or the header.
+    // Entering a left subtree whose largest high endpoint reaches lo is
+    // safe: if nothing there overlaps, its lows, and so every later low,
+    // lie past hi.
+    template <typename T>
+    BasePtr firstOverlapping(const T& lo, const T& hi) const
+        requires hasIntervals
+    {
+        BasePtr x = root();
+        while (x) {
+            if (x->left && !(aggregateAt(x->left) < lo)) {
+                x = x->left;
+                continue;
             }
-            std::string color = (node->color == Color::RED) ? "RED" : "BLACK";
-            std::cout << node->data << "(" << color << ")" << std::endl;
-            print(node->left, indent, false);
-            print(node->right, indent, true);
+            const auto& interval = keyOf(x);
+            if (hi < interval.low)
+                break;
+            if (interval.overlaps(lo, hi))
+                return x;
+            x = x->right;
         }
+        return headerPtr();
     }
 
-    void printTree() const {
-        if (root)
-            print(root, "", true);
+    // Visits every interval overlapping [lo, hi] in order, skipping
+    // subtrees that end before lo or start after hi.
+    template <typename It, typename T, typename F>
+    void visitOverlapping(BasePtr x, const T& lo, const T& hi, F& fn) const
+        requires hasIntervals
+    {
+        if (!x || aggregateAt(x) < lo)
+            return;
+        visitOverlapping<It>(x->left, lo, hi, fn);
+        const auto& interval = keyOf(x);
+        if (hi < interval.low)
+            return;
+        if (interval.overlaps(lo, hi))
+            fn(*It(x));
+        visitOverlapping<It>(x->right, lo, hi, fn);
     }
-};
+
+    // b ? ifTrue : ifFalse by masking, which the compiler cannot turn back
+    // into a branch.
+    static BasePtr select(bool b, BasePtr ifTrue, BasePtr ifFalse) {
+        std::uintptr_t mask = std::uintptr_t(0) - std::uintptr_t(b);
+        return reinterpret_cast<BasePtr>((reinterpret_cast<std::uintptr_t>(ifTrue) & mask) |
+                                         (reinterpret_cast<std::uintptr_t>(ifFalse) & ~mask));
+    }
+
+    // First node in x's subtree whose key is not less than key, or result.
+    // The next node is selected rather than branched to, so descents along
+    // unpredictable paths do not pay a misprediction per level.
+    template <typename K>
+    BasePtr lowerBoundIn(BasePtr x, const K& key, BasePtr result) const {
+        while (x) {
+            bool right = less(keyOf(x), key);
+            result = select(right, result, x);
+            x = select(right, x->right, x->left);
+        }
+        return result;
+    }
+
+    // First node whose key is not less than key, or the header.
+    template <typename K>
+    BasePtr lowerBoundNode(const K& key) const {
+        return lowerBoundIn(root(), key, headerPtr());
+    }
+
+    // First node whose key is greater than key, or the header.
+    template <typename K>
+    BasePtr upperBoundNode(const K& key) const {
+        BasePtr result = headerPtr();
+        BasePtr x = root();
+        while (x) {
+            bool left = less(key, keyOf(x));
+            result = select(left, x, result);
+            x = select(left, x->left, x->right);
+        }
+        return result;
+    }
+
+    // lowerBoundNode by finger search from a node with no key above key
+    // before it: climb to the first ancestor reached from its left that is
+    // not below key, then descend only that ancestor's left subtree. When
+    // the answer lies d positions after from, the climb stays within the
+    // O(log d) levels that separate them.
+    template <typename K>
+    BasePtr lowerBoundFrom(BasePtr from, const K& key) const {
+        BasePtr head = headerPtr();
+        if (from == head || !less(keyOf(from), key))
+            return from;
+        BasePtr y = from;
+        BasePtr result = head;
+        for (BasePtr p = parentOf(y); p != head; p = parentOf(y)) {
+            if (y == p->left && !less(keyOf(p), key)) {
+                result = p;
+                break;
+            }
+            y = p;
+        }
+        return lowerBoundIn(y, key, result);
+    }
+
+    // Visits [lo, hi) in order: one descent to the first node not below lo,
+    // then successor steps, which only enter subtrees that overlap the
+    // range. Costs O(log n + k) for k visited elements.
+    template <typename It, typename K, typename F>
+    void visitRange(const K& lo, const K& hi, F& fn) const {
+        BasePtr end = headerPtr();
+        for (BasePtr x = lowerBoundNode(lo); x != end && less(keyOf(x), hi); x = successor(x))
+            fn(*It(x));
+    }
+
+    // Allocates one node per input element up front, so bulk builds can
+    // link them without any comparisons. Nodes still come from the node
+    // allocator one at a time because each must be freeable on its own.
+    template <typename It>
+    std::vector<NodePtr> createNodes(It first, It last) {
+        std::vector<NodePtr> nodes;
+        if constexpr (std::forward_iterator<It>)
+            nodes.reserve(static_cast<std::size_t>(std::distance(first, last)));
+        try {
+            for (; first != last; ++first)
+                nodes.push_back(createNode(*first));
+        } catch (...) {
+            destroyNodes(nodes);
+            throw;
+        }
+        return nodes;
+    }
+
+    // Creates the nodes in chunks across par's pool. On an exception every
+    // node created so far is freed before it propagates.
+    template <std::random_access_iterator It>
+    std::vector<NodePtr> createNodes(It first, It last, const Parallelism& par) {
+        std::vector<NodePtr> nodes(static_cast<std::size_t>(last - first), nullptr);
+        try {
+            parallelFor(par.pool, 0, nodes.size(), par.cutoff, [&](std::size_t lo, std::size_t hi) {
+                for (std::size_t i = lo; i < hi; ++i)
+                    nodes[i] = createNode(first[static_cast<std::ptrdiff_t>(i)]);
+            });
+        } catch (...) {
+            destroyNodes(nodes);
+            throw;
+        }
+        return nodes;
+    }
+
+    void destroyNodes(const std::vector<NodePtr>& nodes) {
+        for (NodePtr node : nodes) {
+            if (node)
+                destroyNode(node);
+        }
+    }
+
+    // Non-decreasing order, or strictly increasing when keys are unique.
+    bool nodesSorted(const std::vector<NodePtr>& nodes, bool unique) const {
+        for (std::size_t i = 1; i < nodes.size(); ++i) {
+            if (unique ? !less(keyOf(nodes[i - 1]), keyOf(nodes[i])) : less(keyOf(nodes[i]), keyOf(nodes[i - 1])))
+                return false;
+        }
+        return true;
+    }
+
+    // Stable, so equal keys keep their input order; with unique keys the
+    // first occurrence wins, as it would for repeated inserts. With par,
+    // the sort runs on par's pool.
+    void sortNodes(std::vector<NodePtr>& nodes, bool unique, const Parallelism* par) {
+        auto byKey = [this](NodePtr a, NodePtr b) { return less(keyOf(a), keyOf(b)); };
+        if (par)
+            parallelStableSort(par->pool, nodes.begin(), nodes.end(), par->cutoff, byKey);
+        else
+            std::stable_sort(nodes.begin(), nodes.end(), byKey);
+        if (unique && !nodes.empty()) {
+            std::size_t kept = 1;
+            for (std::size_t i = 1; i < nodes.size(); ++i) {
+                if (less(keyOf(nodes[kept - 1]), keyOf(nodes[i])))
+                    nodes[kept++] = nodes[i];
+                else
+                    destroyNode(nodes[i]);
+            }
+            nodes.resize(kept);
+        }
+    }
+
+    // Median splits give a tree whose levels are all full except possibly
+    // the deepest, so coloring exactly that level red (when it is not the
+    // root) keeps every path at the same black height.
+    // The two halves are disjoint, so with par they link in parallel.
+    BasePtr linkBalanced(const std::vector<NodePtr>& nodes, std::size_t lo, std::size_t hi, BasePtr parent,
+                         int depth, int redDepth, const Parallelism* par = nullptr) {
+        if (lo == hi)
+            return nullptr;
+        std::size_t mid = lo + (hi - lo) / 2;
+        BasePtr x = nodes[mid];
+        x->parentColor = 0;
+        setParent(x, parent);
+        setColor(x, depth == redDepth && depth > 0 ? Color::RED : Color::BLACK);
+        if (par && hi - lo > par->cutoff) {
+            par->pool.invoke([&] { x->left = linkBalanced(nodes, lo, mid, x, depth + 1, redDepth, par); },
+                             [&] { x->right = linkBalanced(nodes, mid + 1, hi, x, depth + 1, redDepth, par); });
+        } else {
+            x->left = linkBalanced(nodes, lo, mid, x, depth + 1, redDepth);
+            x->right = linkBalanced(nodes, mid + 1, hi, x, depth + 1, redDepth);
+        }
+        pullUp(x);
+        return x;
+    }
+
+    // Replaces the (empty) tree with the sorted nodes in O(n).
+    void linkSorted(const std::vector<NodePtr>& nodes, const Parallelism* par = nullptr) {
+        int redDepth = static_cast<int>(std::bit_width(nodes.size())) - 1;
+        header.left = linkBalanced(nodes, 0, nodes.size(), &header, 0, redDepth, par);
+        resetExtremes(nodes.size());
+    }
+
+    // Shared by the from_sorted/from_unsorted factories of the containers.
+    template <typename It>
+    void buildFromSorted(It first, It last, bool verify, bool unique) {
+        std::vector<NodePtr> nodes = createNodes(first, last);
+        if (verify && !nodesSorted(nodes, unique)) {
+            destroyNodes(nodes);
+            throw std::invalid_argument("from_sorted: input is not sorted");
+        }
+        linkSorted(nodes);
+    }
+
+    // As above, creating and linking the nodes across par's pool.
+    template <std::random_access_iterator It>
+    void buildFromSorted(It first, It last, bool verify, bool unique, const Parallelism& par) {
+        if (!parallelOrNull(&par)) {
+            buildFromSorted(first, last, verify, unique);
+            return;
+        }
+        std::vector<NodePtr> nodes = createNodes(first, last, par);
+        if (verify && !nodesSorted(nodes, unique)) {
+            destroyNodes(nodes);
+            throw std::invalid_argument("from_sorted: input is not sorted");
+        }
+        linkSorted(nodes, &par);
+    }
+
+    template <typename It>
+    void buildFromUnsorted(It first, It last, bool unique, const Parallelism* par = nullptr) {
+        std::vector<NodePtr> nodes = createNodes(first, last);
+        try {
+            sortNodes(nodes, unique, par);
+        } catch (...) {
+            destroyNodes(nodes);
+            throw;
+        }
+        linkSorted(nodes, parallelOrNull(par));
+    }
+
+    // Join-based bulk operations. They cut the tree into detached pieces and
+    // splice pieces back together around a middle node with joinPieces,
+    // which walks down only as far as the black heights differ. Split
+    // and the set operations are built from that one primitive. Their bounds
+    // follow Blelloch, Ferizovic and Sun, "Just Join for Parallel Ordered
+    // Sets". Comparisons must not throw while pieces are detached.
+
+    // Workers allocate and free nodes concurrently, which only
+    // std::allocator is known to allow; other allocators run sequentially.
+    static const Parallelism* parallelOrNull(const Parallelism* par) {
+        return std::is_same_v<NodeAllocator, std::allocator<Node>> ? par : nullptr;
+    }
+
+    // Runs left and right, as a fork-join pair on par's pool if the
+    // subproblem exceeds the cutoff. A piece of black height h holds at
+    // least 2^h - 1 elements.
+    template <typename L, typename R>
+    static void forkJoin(const Parallelism* par, int blackHeight, const L& left, const R& right) {
+        if (par && (std::size_t(1) << std::min(blackHeight, 63)) > par->cutoff) {
+            par->pool.invoke(left, right);
+        } else {
+            left();
+            right();
+        }
+    }
+
+    // A detached subtree with a black root, or no nodes at all. Every path
+    // from root to a null link crosses blackHeight black nodes. The root's
+    // parent link is stale until the piece is hung somewhere.
+    struct Piece {
+        BasePtr root = nullptr;
+        int blackHeight = 0;
+    };
+
+    static int blackHeightOf(BasePtr x) {
+        int height = 0;
+        for (; x; x = x->left)
+            height += colorOf(x) == Color::BLACK ? 1 : 0;
+        return height;
+    }
+
+    // Makes a piece of a subtree of black height blackHeight; a red root is
+    // blackened, which adds one to every path.
+    static Piece detach(BasePtr x, int blackHeight) {
+        if (colorOf(x) == Color::RED) {
+            setColor(x, Color::BLACK);
+            ++blackHeight;
+        }
+        return {x, blackHeight};
+    }
+
+    static void linkChild(BasePtr parent, BasePtr& slot, BasePtr child) {
+        slot = child;
+        if (child)
+            setParent(child, parent);
+    }
+
+    // Joins left, k and right, whose keys must be in that order, in
+    // O(|left.blackHeight - right.blackHeight| + 1). Equal heights just make
+    // k a black root. Otherwise k is linked red in place of the first black
+    // node of matching height on the taller piece's inner spine. That node
+    // becomes k's child, and a red-red violation above k is fixed as after an
+    // insert. A temporary header gives the fixup a black parent to stop at.
+    Piece joinPieces(Piece left, BasePtr k, Piece right) {
+        if (left.blackHeight == right.blackHeight) {
+            linkChild(k, k->left, left.root);
+            linkChild(k, k->right, right.root);
+            setColor(k, Color::BLACK);
+            pullUp(k);
+            return {k, left.blackHeight + 1};
+        }
+
+        bool intoLeft = left.blackHeight > right.blackHeight;
+        Piece& tall = intoLeft ? left : right;
+        Piece& low = intoLeft ? right : left;
+        NodeBase top;
+        linkChild(&top, top.left, tall.root);
+        BasePtr p = &top;
+        BasePtr c = tall.root;
+        int height = tall.blackHeight;
+        while (colorOf(c) == Color::RED || height != low.blackHeight) {
+            if (colorOf(c) == Color::BLACK)
+                --height;
+            p = c;
+            c = intoLeft ? c->right : c->left;
+        }
+        if (intoLeft) {
+            linkChild(p, p->right, k);
+            linkChild(k, k->left, c);
+            linkChild(k, k->right, low.root);
+        } else {
+            linkChild(p, p->left, k);
+            linkChild(k, k->left, low.root);
+            linkChild(k, k->right, c);
+        }
+        setColor(k, Color::RED);
+        pullUpToRoot(k);
+        rebalanceInsert(k);
+        return detach(top.left, tall.blackHeight);
+    }
+
+    // Splits piece t into the nodes for which goesLeft holds, which must
+    // form a prefix in order, and the rest. Each level rejoins the node with
+    // the side it stays on, so the joins telescope to O(log n) in total.
+    template <typename Pred>
+    void splitPiece(Piece t, const Pred& goesLeft, Piece& left, Piece& right) {
+        if (!t.root) {
+            left = right = Piece();
+            return;
+        }
+        BasePtr x = t.root;
+        Piece l = detach(x->left, t.blackHeight - 1);
+        Piece r = detach(x->right, t.blackHeight - 1);
+        if (goesLeft(x)) {
+            Piece rest;
+            splitPiece(r, goesLeft, rest, right);
+            left = joinPieces(l, x, rest);
+        } else {
+            Piece rest;
+            splitPiece(l, goesLeft, left, rest);
+            right = joinPieces(rest, x, r);
+        }
+    }
+
+    // Cuts the largest node out of a non-empty piece in O(log n).
+    void splitLast(Piece t, Piece& rest, BasePtr& last) {
+        BasePtr x = t.root;
+        Piece l = detach(x->left, t.blackHeight - 1);
+        Piece r = detach(x->right, t.blackHeight - 1);
+        if (!r.root) {
+            rest = l;
+            last = x;
+            return;
+        }
+        Piece shorter;
+        splitLast(r, shorter, last);
+        rest = joinPieces(l, x, shorter);
+    }
+
+    // Concatenates two pieces without a middle node by borrowing left's
+    // largest node.
+    Piece joinPieces(Piece left, Piece right) {
+        if (!left.root)
+            return right;
+        if (!right.root)
+            return left;
+        Piece rest;
+        BasePtr last;
+        splitLast(left, rest, last);
+        return joinPieces(rest, last, right);
+    }
+
+    std::size_t destroyPiece(Piece t) {
+        if (!t.root)
+            return 0;
+        setParent(t.root, nullptr);
+        return destroy(t.root);
+    }
+
+    // Splits piece a around key into the parts before, equal to and after
+    // it. Two splits are needed because a multiset can hold many equal keys.
+    template <typename K>
+    void splitAround(Piece a, const K& key, Piece& before, Piece& equal, Piece& after) {
+        Piece rest;
+        splitPiece(a, [&](BasePtr x) { return less(keyOf(x), key); }, before, rest);
+        splitPiece(rest, [&](BasePtr x) { return !less(key, keyOf(x)); }, equal, after);
+    }
+
+    // The recursions below expose b's root k, split a around k's key,
+    // recurse on both sides and join the results. Each adds the number of
+    // nodes it frees to freed.
+
+    // Keeps every node. For multisets, a's elements precede b's equal
+    // ones. With unique keys a's element wins and b's is freed. Exposing the
+    // taller piece's root leaves most of its subtrees untouched when the
+    // other piece is small.
+    Piece unitePieces(Piece a, Piece b, bool unique, std::size_t& freed, const Parallelism* par) {
+        if (!a.root)
+            return b;
+        if (!b.root)
+            return a;
+        bool exposeA = a.blackHeight >= b.blackHeight;
+        Piece& tall = exposeA ? a : b;
+        Piece& other = exposeA ? b : a;
+        BasePtr k = tall.root;
+        Piece tl = detach(k->left, tall.blackHeight - 1);
+        Piece tr = detach(k->right, tall.blackHeight - 1);
+        const Key& key = keyOf(k);
+        Piece ol, or_;
+        BasePtr middle = k;
+        if (unique) {
+            Piece equal;
+            splitAround(other, key, ol, equal, or_);
+            if (equal.root) {
+                // a's element stays; the duplicate from b is freed.
+                BasePtr loser = exposeA ? equal.root : k;
+                middle = exposeA ? k : equal.root;
+                destroyNode(asNode(loser));
+                ++freed;
+            }
+        } else if (exposeA) {
+            // b's elements equal to k follow it.
+            splitPiece(other, [&](BasePtr x) { return less(keyOf(x), key); }, ol, or_);
+        } else {
+            // a's elements equal to k precede it.
+            splitPiece(other, [&](BasePtr x) { return !less(key, keyOf(x)); }, ol, or_);
+        }
+        Piece l, r;
+        std::size_t freedRight = 0;
+        forkJoin(
+            par, tall.blackHeight,
+            [&] { l = exposeA ? unitePieces(tl, ol, unique, freed, par) : unitePieces(ol, tl, unique, freed, par); },
+            [&] {
+                r = exposeA ? unitePieces(tr, or_, unique, freedRight, par)
+                            : unitePieces(or_, tr, unique, freedRight, par);
+            });
+        freed += freedRight;
+        return joinPieces(l, middle, r);
+    }
+
+    // Keeps a's nodes whose key occurs in b and frees the rest.
+    Piece intersectPieces(Piece a, Piece b, std::size_t& freed, const Parallelism* par) {
+        if (!a.root || !b.root) {
+            freed += destroyPiece(a) + destroyPiece(b);
+            return Piece();
+        }
+        BasePtr k = b.root;
+        Piece bl = detach(k->left, b.blackHeight - 1);
+        Piece br = detach(k->right, b.blackHeight - 1);
+        Piece al, equal, ar;
+        splitAround(a, keyOf(k), al, equal, ar);
+        destroyNode(asNode(k));
+        ++freed;
+        Piece l, r;
+        std::size_t freedRight = 0;
+        forkJoin(
+            par, std::max(a.blackHeight, b.blackHeight), [&] { l = intersectPieces(al, bl, freed, par); },
+            [&] { r = intersectPieces(ar, br, freedRight, par); });
+        freed += freedRight;
+        return joinPieces(joinPieces(l, equal), r);
+    }
+
+    // Keeps a's nodes whose key does not occur in b and frees the rest.
+    Piece subtractPieces(Piece a, Piece b, std::size_t& freed, const Parallelism* par) {
+        if (!a.root || !b.root) {
+            freed += destroyPiece(b);
+            return a;
+        }
+        BasePtr k = b.root;
+        Piece bl = detach(k->left, b.blackHeight - 1);
+        Piece br = detach(k->right, b.blackHeight - 1);
+        Piece al, equal, ar;
+        splitAround(a, keyOf(k), al, equal, ar);
+        destroyNode(asNode(k));
+        freed += 1 + destroyPiece(equal);
+        Piece l, r;
+        std::size_t freedRight = 0;
+        forkJoin(
+            par, std::max(a.blackHeight, b.blackHeight), [&] { l = subtractPieces(al, bl, freed, par); },
+            [&] { r = subtractPieces(ar, br, freedRight, par); });
+        freed += freedRight;
+        return joinPieces(l, r);
+    }
+
+    // Detaches all nodes, leaving the tree empty.
+    Piece takePiece() {
+        Piece t{root(), blackHeightOf(root())};
+        header.left = nullptr;
+        resetExtremes(0);
+        return t;
+    }
+
+    void adoptPiece(Piece t, std::size_t count) {
+        linkChild(&header, header.left, t.root);
+        resetExtremes(count);
+    }
+
+    // Takes other's nodes for a bulk operation. Nodes from an unequal
+    // allocator, or from this very tree, are copied first.
+    Piece takeNodesOf(RBTreeBase& other, std::size_t& count) {
+        if (&other != this && alloc == other.alloc) {
+            count = other.nodeCount;
+            return other.takePiece();
+        }
+        RBTreeBase copy(comp, Allocator(alloc));
+        copy.cloneFrom(other);
+        if (&other != this)
+            other.clear();
+        count = copy.nodeCount;
+        return copy.takePiece();
+    }
+
+    // Appends right's nodes, whose keys must not sort before (with unique
+    // keys: must sort after) any key here, in O(log n).
+    void joinWith(RBTreeBase& right, bool unique) {
+        if (right.empty() || &right == this)
+            return;
+        if (!empty()) {
+            bool ordered = unique ? less(keyOf(rightmost()), keyOf(right.leftmost))
+                                  : !less(keyOf(right.leftmost), keyOf(rightmost()));
+            if (!ordered)
+                throw std::invalid_argument("RBTree::join: right tree does not sort after this one");
+        }
+        std::size_t rightCount;
+        Piece b = takeNodesOf(right, rightCount);
+        std::size_t count = addCount(nodeCount, rightCount);
+        adoptPiece(joinPieces(takePiece(), b), count);
+    }
+
+    // Moves the elements whose key is not less than key into right, which
+    // must be empty and share this tree's allocator, in O(log n). The
+    // halves' sizes come from the subtree sizes where there are any and
+    // are left unknown otherwise.
+    template <typename K>
+    void splitInto(const K& key, RBTreeBase& right) {
+        std::size_t count = nodeCount;
+        Piece l, r;
+        splitPiece(takePiece(), [&](BasePtr x) { return less(keyOf(x), key); }, l, r);
+        if constexpr (hasSizes) {
+            std::size_t leftCount = sizeOf(l.root);
+            adoptPiece(l, leftCount);
+            right.adoptPiece(r, count - leftCount);
+        } else {
+            adoptPiece(l, l.root ? unknownCount : 0);
+            right.adoptPiece(r, r.root ? unknownCount : 0);
+        }
+    }
+
+    // The set operations run their two recursive calls as a fork-join pair
+    // when given a Parallelism; the calls touch disjoint pieces.
+    void uniteWith(RBTreeBase& other, bool unique, const Parallelism* par = nullptr) {
+        std::size_t otherCount;
+        Piece b = takeNodesOf(other, otherCount);
+        std::size_t count = addCount(nodeCount, otherCount);
+        std::size_t freed = 0;
+        Piece result = unitePieces(takePiece(), b, unique, freed, parallelOrNull(par));
+        adoptPiece(result, subtractCount(count, freed));
+    }
+
+    void intersectWith(RBTreeBase& other, const Parallelism* par = nullptr) {
+        std::size_t otherCount;
+        Piece b = takeNodesOf(other, otherCount);
+        std::size_t count = addCount(nodeCount, otherCount);
+        std::size_t freed = 0;
+        Piece result = intersectPieces(takePiece(), b, freed, parallelOrNull(par));
+        adoptPiece(result, subtractCount(count, freed));
+    }
+
+    void subtractWith(RBTreeBase& other, const Parallelism* par = nullptr) {
+        std::size_t otherCount;
+        Piece b = takeNodesOf(other, otherCount);
+        std::size_t count = addCount(nodeCount, otherCount);
+        std::size_t freed = 0;
+        Piece result = subtractPieces(takePiece(), b, freed, parallelOrNull(par));
+        adoptPiece(result, subtractCount(count, freed));
+    }
+
+    // Finds the node a new element with this key hangs under; equal keys
+    // go to the right so insertion order is kept among them. An empty tree
+    // hangs its root on the header's left. A key that sorts at or after the
+    // current maximum is appended after one comparison.
+    BasePtr insertParent(const Key& key, bool& asLeft) const {
+        if (rightmost() && !less(key, keyOf(rightmost()))) {
+            asLeft = false;
+            return rightmost();
+        }
+        BasePtr y = headerPtr();
+        BasePtr x = root();
+        asLeft = true;
+        while (x) {
+            y = x;
+            asLeft = less(key, keyOf(x));
+            x = asLeft ? x->left : x->right;
+        }
+        return y;
+    }
+
+    // Single descent for containers with unique keys: returns the node
+    // holding an equivalent key, or null with parent/asLeft set to where a
+    // new node with this key belongs. Appends skip the descent as above.
+    template <typename K>
+    NodePtr uniqueInsertParent(const K& key, BasePtr& parent, bool& asLeft) const {
+        if (rightmost()) {
+            std::partial_ordering cmp = order(key, keyOf(rightmost()));
+            if (cmp == 0)
+                return asNode(rightmost());
+            if (cmp > 0) {
+                parent = rightmost();
+                asLeft = false;
+                return nullptr;
+            }
+        }
+        BasePtr x = root();
+        parent = headerPtr();
+        asLeft = true;
+        while (x) {
+            std::partial_ordering cmp = order(key, keyOf(x));
+            if (cmp == 0)
+                return asNode(x);
+            parent = x;
+            asLeft = cmp < 0;
+            x = asLeft ? x->left : x->right;
+        }
+        return nullptr;
+    }
+
+    // Places key directly before hint when that keeps the order, std::set
+    // style: checks hint and its predecessor, which is amortized O(1) for
+    // neighbouring hints. Returns false if the hint is unusable. With
+    // unique keys an equivalent neighbour is reported through existing.
+    template <typename K>
+    bool hintedInsertParent(BasePtr hint, const K& key, bool unique, BasePtr& parent, bool& asLeft,
+                            NodePtr& existing) const {
+        BasePtr head = headerPtr();
+        existing = nullptr;
+        if (hint != head) {
+            std::partial_ordering cmp = order(key, keyOf(hint));
+            if (cmp > 0)
+                return false;
+            if (unique && cmp == 0) {
+                existing = asNode(hint);
+                return true;
+            }
+        }
+
+        // The predecessor either tops hint's left subtree and has a free
+        // right link, or is an ancestor and hint's left link is free. Before
+        // end() it is the cached maximum.
+        BasePtr prev;
+        if (hint == head) {
+            prev = rightmost();
+            parent = prev ? prev : head;
+            asLeft = !prev;
+        } else if (hint->left) {
+            prev = maximum(hint->left);
+            parent = prev;
+            asLeft = false;
+        } else {
+            BasePtr x = hint;
+            prev = parentOf(x);
+            while (prev && x == prev->left) {
+                x = prev;
+                prev = parentOf(prev);
+            }
+            parent = hint;
+            asLeft = true;
+        }
+        if (prev && prev != head) {
+            std::partial_ordering cmp = order(key, keyOf(prev));
+            if (cmp < 0)
+                return false;
+            if (unique && cmp == 0) {
+                existing = asNode(prev);
+                return true;
+            }
+        }
+        return true;
+    }
+
+    void linkNode(BasePtr z, BasePtr parent, bool asLeft) {
+        setParent(z, parent);
+        if (asLeft)
+            parent->left = z;
+        else
+            parent->right = z;
+        if (parent == headerPtr() || (parent == leftmost && asLeft))
+            leftmost = z;
+        if (parent == headerPtr() || (parent == rightmost() && !asLeft))
+            header.right = z;
+        nodeCount = addCount(nodeCount, 1);
+        pullUpToRoot(z);
+        insertFixup(z);
+    }
+
+    // Bidirectional in-order iterator over the stored values. It is a single
+    // node pointer: incrementing walks parent links to the successor in
+    // amortized O(1) without a stack, and end() is the header. Set elements
+    // are keys and stay read-only; map iterators can modify the mapped value.
+    template <bool Const>
+    class Iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = Value;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const Value*, Value*>;
+        using reference = std::conditional_t<Const, const Value&, Value&>;
+
+        Iterator() : node(nullptr) {}
+
+        template <bool WasConst>
+            requires(Const && !WasConst)
+        Iterator(const Iterator<WasConst>& other) : node(other.node) {}
+
+        reference operator*() const { return asNode(node)->data; }
+        pointer operator->() const { return &asNode(node)->data; }
+
+        Iterator& operator++() {
+            node = successor(node);
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator old = *this;
+            node = successor(node);
+            return old;
+        }
+
+        Iterator& operator--() {
+            node = predecessor(node);
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            Iterator old = *this;
+            node = predecessor(node);
+            return old;
+        }
+
+        template <bool OtherConst>
+        bool operator==(const Iterator<OtherConst>& other) const { return node == other.node; }
+
+    private:
+        friend class RBTreeBase;
+        template <bool>
+        friend class Iterator;
+
+        explicit Iterator(BasePtr x) : node(x) {}
+
+        BasePtr node;
+    };
+
+public:
+    using key_type = Key;
+    using value_type = Value;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+    using const_iterator = Iterator<true>;
+    using iterator = std::conditional_t<readOnlyValues, const_iterator, Iterator<false>>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+
+protected:
+    static iterator makeIterator(BasePtr node) {
+        return iterator(node);
+    }
+
+    // Lookups report a miss as end().
+    iterator iteratorOrEnd(BasePtr node) const {
+        return iterator(node ? node : headerPtr());
+    }
+
+    static BasePtr nodeOf(const_iterator pos) {
+        return pos.node;
+    }
+
+public:
+    static constexpr std::size_t nodeBytes = sizeof(Node);
+
+    RBTreeBase() : RBTreeBase(Compare()) {}
+
+    explicit RBTreeBase(const Compare& compare, const Allocator& allocator = Allocator())
+        : comp(compare), alloc(allocator), leftmost(&header), nodeCount(0) {}
+
+    explicit RBTreeBase(const Allocator& allocator) : RBTreeBase(Compare(), allocator) {}
+
+    RBTreeBase(const RBTreeBase& other)
+        : comp(other.comp), alloc(NodeTraits::select_on_container_copy_construction(other.alloc)),
+          leftmost(&header), nodeCount(0) {
+        cloneFrom(other);
+    }
+
+    RBTreeBase(RBTreeBase&& other) noexcept
+        : comp(std::move(other.comp)), alloc(std::move(other.alloc)), leftmost(&header),
+          nodeCount(0) {
+        stealFrom(other);
+    }
+
+    RBTreeBase& operator=(const RBTreeBase& other) {
+        if (this != &other) {
+            clear();
+            comp = other.comp;
+            if constexpr (NodeTraits::propagate_on_container_copy_assignment::value)
+                alloc = other.alloc;
+            cloneFrom(other);
+        }
+        return *this;
+    }
+
+    RBTreeBase& operator=(RBTreeBase&& other) noexcept(NodeTraits::propagate_on_container_move_assignment::value ||
+                                                       NodeTraits::is_always_equal::value) {
+        if (this == &other)
+            return *this;
+        clear();
+        comp = std::move(other.comp);
+        if constexpr (NodeTraits::propagate_on_container_move_assignment::value) {
+            alloc = std::move(other.alloc);
+        } else if (!(alloc == other.alloc)) {
+            // Nodes cannot change hands between unequal allocators.
+            cloneFrom(other);
+            other.clear();
+            return *this;
+        }
+        stealFrom(other);
+        return *this;
+    }
+
+    ~RBTreeBase() {
+        destroy(root());
+    }
+
+    void clear() {
+        destroy(root());
+        header.left = nullptr;
+        resetExtremes(0);
+    }
+
+    Allocator get_allocator() const {
+        return Allocator(alloc);
+    }
+
+    Compare key_comp() const {
+        return comp;
+    }
+
+    bool empty() const {
+        return !root();
+    }
+
+    // O(1), except for the first call after split left the count unknown,
+    // which counts in O(n). That call writes the cached count, so it must
+    // not race with other calls on the same tree.
+    size_type size() const {
+        if (nodeCount == unknownCount)
+            nodeCount = static_cast<size_type>(std::distance(begin(), end()));
+        return nodeCount;
+    }
+
+    // The extremes are cached, so peeking at them is O(1). Neither may be
+    // called on an empty tree.
+    const value_type& min() const {
+        return asNode(leftmost)->data;
+    }
+
+    const value_type& max() const {
+        return asNode(rightmost())->data;
+    }
+
+    // Moves the smallest element out and unlinks its node without a
+    // descent. Must not be called on an empty tree.
+    value_type pop_min() {
+        BasePtr z = leftmost;
+        value_type value = std::move(asNode(z)->data);
+        removeNode(z);
+        return value;
+    }
+
+    value_type pop_max() {
+        BasePtr z = rightmost();
+        value_type value = std::move(asNode(z)->data);
+        removeNode(z);
+        return value;
+    }
+
+    iterator begin() {
+        return iterator(leftmost);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(leftmost);
+    }
+
+    const_iterator cbegin() const {
+        return begin();
+    }
+
+    iterator end() {
+        return iterator(&header);
+    }
+
+    const_iterator end() const {
+        return const_iterator(headerPtr());
+    }
+
+    const_iterator cend() const {
+        return end();
+    }
+
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    void remove(const Key& key) {
+        if (NodePtr z = findNode(key))
+            removeNode(z);
+    }
+
+    // Removes the element at pos and returns the one after it.
+    iterator erase(const_iterator pos) {
+        BasePtr next = successor(pos.node);
+        removeNode(pos.node);
+        return iterator(next);
+    }
+
+    iterator find(const Key& key) {
+        return iteratorOrEnd(findNode(key));
+    }
+
+    const_iterator find(const Key& key) const {
+        return iteratorOrEnd(findNode(key));
+    }
+
+    bool contains(const Key& key) const {
+        return findNode(key) != nullptr;
+    }
+
+    size_type count(const Key& key) const {
+        return countEqual(root(), key);
+    }
+
+    // With a transparent comparator such as the default std::less<>, lookups
+    // accept any key type that orders against Key, e.g. a std::string_view
+    // for std::string keys, so no temporary key is built.
+    template <typename K>
+        requires TransparentCompare<Compare>
+    iterator find(const K& key) {
+        return iteratorOrEnd(findNode(key));
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    const_iterator find(const K& key) const {
+        return iteratorOrEnd(findNode(key));
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    bool contains(const K& key) const {
+        return findNode(key) != nullptr;
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    size_type count(const K& key) const {
+        return countEqual(root(), key);
+    }
+
+    iterator lower_bound(const Key& key) {
+        return iterator(lowerBoundNode(key));
+    }
+
+    const_iterator lower_bound(const Key& key) const {
+        return const_iterator(lowerBoundNode(key));
+    }
+
+    iterator upper_bound(const Key& key) {
+        return iterator(upperBoundNode(key));
+    }
+
+    const_iterator upper_bound(const Key& key) const {
+        return const_iterator(upperBoundNode(key));
+    }
+
+    std::pair<iterator, iterator> equal_range(const Key& key) {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    iterator lower_bound(const K& key) {
+        return iterator(lowerBoundNode(key));
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    const_iterator lower_bound(const K& key) const {
+        return const_iterator(lowerBoundNode(key));
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    iterator upper_bound(const K& key) {
+        return iterator(upperBoundNode(key));
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    const_iterator upper_bound(const K& key) const {
+        return const_iterator(upperBoundNode(key));
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    std::pair<iterator, iterator> equal_range(const K& key) {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    // Calls fn on every element with a key in [lo, hi), in order.
+    template <typename F>
+    void for_each_in_range(const Key& lo, const Key& hi, F&& fn) {
+        visitRange<iterator>(lo, hi, fn);
+    }
+
+    template <typename F>
+    void for_each_in_range(const Key& lo, const Key& hi, F&& fn) const {
+        visitRange<const_iterator>(lo, hi, fn);
+    }
+
+    template <typename K, typename F>
+        requires TransparentCompare<Compare>
+    void for_each_in_range(const K& lo, const K& hi, F&& fn) {
+        visitRange<iterator>(lo, hi, fn);
+    }
+
+    template <typename K, typename F>
+        requires TransparentCompare<Compare>
+    void for_each_in_range(const K& lo, const K& hi, F&& fn) const {
+        visitRange<const_iterator>(lo, hi, fn);
+    }
+
+    // Order statistics, available with the OrderStatistics policy. Each is
+    // a single O(log n) descent guided by the subtree sizes.
+
+    // Number of elements whose key is less than key.
+    size_type rank(const Key& key) const
+        requires hasSizes
+    {
+        return rankOf(key);
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare> && hasSizes
+    size_type rank(const K& key) const {
+        return rankOf(key);
+    }
+
+    // The element at 0-based position k in order, or end() if k >= size().
+    // select(size() * p / 100) is the p-th percentile.
+    iterator select(size_type k)
+        requires hasSizes
+    {
+        return iterator(selectNode(k));
+    }
+
+    const_iterator select(size_type k) const
+        requires hasSizes
+    {
+        return const_iterator(selectNode(k));
+    }
+
+    // Number of elements whose key lies in [lo, hi).
+    size_type count_between(const Key& lo, const Key& hi) const
+        requires hasSizes
+    {
+        return countBetween(lo, hi);
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare> && hasSizes
+    size_type count_between(const K& lo, const K& hi) const {
+        return countBetween(lo, hi);
+    }
+
+    // Range aggregates, available with any augmentation policy. Both are
+    // empty for an empty range.
+
+    // Aggregate of the whole tree in O(1).
+    std::optional<Aggregate> aggregate() const
+        requires hasAggregate
+    {
+        if (!root())
+            return std::nullopt;
+        return aggregateAt(root());
+    }
+
+    // Aggregate of the elements whose key lies in [lo, hi) in O(log n),
+    // e.g. a range sum with RangeSum or a range minimum with RangeMin.
+    std::optional<Aggregate> aggregate(const Key& lo, const Key& hi) const
+        requires hasAggregate
+    {
+        return aggregateRange(lo, hi);
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare> && hasAggregate
+    std::optional<Aggregate> aggregate(const K& lo, const K& hi) const {
+        return aggregateRange(lo, hi);
+    }
+
+    // Interval queries, available with the IntervalOverlap policy on trees
+    // keyed by Interval. Endpoints are compared with <, and [lo, hi] is
+    // closed like the stored intervals.
+
+    // The first interval in order that overlaps [lo, hi], or end(), in
+    // O(log n).
+    template <typename T>
+        requires hasIntervals
+    iterator find_overlapping(const T& lo, const T& hi) {
+        return iterator(firstOverlapping(lo, hi));
+    }
+
+    template <typename T>
+        requires hasIntervals
+    const_iterator find_overlapping(const T& lo, const T& hi) const {
+        return const_iterator(firstOverlapping(lo, hi));
+    }
+
+    // Calls fn on every interval overlapping [lo, hi] in order, in
+    // O(k log n) for k matches.
+    template <typename T, typename F>
+        requires hasIntervals
+    void for_each_overlapping(const T& lo, const T& hi, F&& fn) {
+        visitOverlapping<iterator>(root(), lo, hi, fn);
+    }
+
+    template <typename T, typename F>
+        requires hasIntervals
+    void for_each_overlapping(const T& lo, const T& hi, F&& fn) const {
+        visitOverlapping<const_iterator>(root(), lo, hi, fn);
+    }
+
+    // Also checks the cached extremes and element count.
+    bool isValid() const {
+        BasePtr top = root();
+        if (leftmost != (top ? minimum(top) : headerPtr()) || rightmost() != (top ? maximum(top) : nullptr))
+            return false;
+        if (nodeCount != unknownCount && static_cast<size_type>(std::distance(begin(), end())) != nodeCount)
+            return false;
+        return colorOf(top) == Color::BLACK && checkSubtree(top, headerPtr()) >= 0;
+    }
+
+    void print(BasePtr node, std::string indent, bool last) const {
+        if (node) {
+            std::cout << indent;
+            if (last) {
+                std::cout << "R----";
+                indent += "   ";
+            } else {
+                std::cout << "L----";
+                indent += "|  ";
+            }
+            std::string color = (colorOf(node) == Color::RED) ? "RED" : "BLACK";
+            std::cout << keyOf(node) << "(" << color << ")" << std::endl;
+            print(node->left, indent, false);
+            print(node->right, indent, true);
+        }
+    }
+
+    void printTree() const {
+        if (root())
+            print(root(), "", true);
+    }
+};
+
+// Red-Black Tree holding values of type T ordered by Compare. Equivalent
+// values are all kept, in insertion order.
+template <typename T, typename Compare = std::less<>, typename Allocator = std::allocator<T>,
+          typename Augment = NoAugment>
+class RBTree : public RBTreeBase<T, T, IdentityKey, Compare, Allocator, Augment> {
+private:
+    using Base = RBTreeBase<T, T, IdentityKey, Compare, Allocator, Augment>;
+    using typename Base::BasePtr;
+    using typename Base::NodePtr;
+
+public:
+    using typename Base::const_iterator;
+    using typename Base::iterator;
+
+private:
+    // Only compares against the caller's value, so the node is allocated
+    // and the value copied or moved into it exactly once.
+    template <typename U>
+    void insertValue(U&& data) {
+        bool asLeft;
+        BasePtr parent = this->insertParent(data, asLeft);
+        this->linkNode(this->createNode(std::forward<U>(data)), parent, asLeft);
+    }
+
+    // Links z as close before hint as the order allows, or wherever a
+    // plain insert would put it if the hint is wrong.
+    iterator linkNear(const_iterator hint, NodePtr z) {
+        BasePtr parent;
+        bool asLeft;
+        NodePtr existing;
+        if (!this->hintedInsertParent(this->nodeOf(hint), z->data, false, parent, asLeft, existing))
+            parent = this->insertParent(z->data, asLeft);
+        this->linkNode(z, parent, asLeft);
+        return this->makeIterator(z);
+    }
+
+    using typename Base::Piece;
+
+public:
+    // One change for apply_batch: insert value, or remove one element
+    // equivalent to it.
+    struct Op {
+        enum Kind { Insert, Remove };
+
+        Kind kind;
+        T value;
+    };
+
+private:
+    // The batch code handles ops through O*, where O is Op for batches the
+    // tree consumes and const Op for borrowed ones. Inserted values are
+    // taken with std::move, which copies out of a const Op.
+
+    // The ops on one key once removes have cancelled earlier inserts of
+    // the same key: how many existing elements to remove, and a range of
+    // the batch's surviving inserts.
+    struct BatchGroup {
+        const T* key;
+        std::size_t removes;
+        std::size_t insertsFirst;
+        std::size_t insertsLast;
+    };
+
+    // Groups are located and applied this many at a time.
+    static constexpr std::size_t batchChunk = 1024;
+
+    static const Op& opOf(const Op& op) {
+        return op;
+    }
+
+    static const Op& opOf(const Op* op) {
+        return *op;
+    }
+
+    // Stable; batches that arrive sorted skip the sort. With par, it runs
+    // on par's pool; it creates no nodes, so any allocator may take part.
+    template <typename E>
+    void sortBatch(std::span<E> items, const Parallelism* par) const {
+        auto byKey = [this](const E& a, const E& b) { return this->less(opOf(a).value, opOf(b).value); };
+        if (std::is_sorted(items.begin(), items.end(), byKey))
+            return;
+        if (par)
+            parallelStableSort(par->pool, items.begin(), items.end(), par->cutoff, byKey);
+        else
+            std::stable_sort(items.begin(), items.end(), byKey);
+    }
+
+    // The ops in key order. A consumed batch is sorted in place; a
+    // borrowed one through pointers, leaving the caller's order alone.
+    template <typename O>
+    std::vector<O*> sortedBatch(std::span<O> ops, const Parallelism* par) const {
+        if constexpr (!std::is_const_v<O>)
+            sortBatch(ops, par);
+        std::vector<O*> sorted(ops.size());
+        for (std::size_t i = 0; i < ops.size(); ++i)
+            sorted[i] = &ops[i];
+        if constexpr (std::is_const_v<O>)
+            sortBatch(std::span<O*>(sorted), par);
+        return sorted;
+    }
+
+    // Expects ops sorted by key. Groups whose ops all cancel are dropped.
+    template <typename O>
+    void collapseBatch(const std::vector<O*>& ops, std::vector<BatchGroup>& groups, std::vector<O*>& inserts) const {
+        groups.reserve(ops.size());
+        inserts.reserve(ops.size());
+        for (std::size_t i = 0; i < ops.size();) {
+            std::size_t j = i + 1;
+            while (j < ops.size() && !this->less(ops[i]->value, ops[j]->value))
+                ++j;
+            BatchGroup group{&ops[i]->value, 0, inserts.size(), 0};
+            for (std::size_t k = i; k < j; ++k) {
+                if (ops[k]->kind == Op::Insert)
+                    inserts.push_back(ops[k]);
+                else if (inserts.size() > group.insertsFirst)
+                    inserts.pop_back();
+                else
+                    ++group.removes;
+            }
+            group.insertsLast = inserts.size();
+            if (group.removes > 0 || group.insertsLast > group.insertsFirst)
+                groups.push_back(group);
+            i = j;
+        }
+    }
+
+    // One in-order sweep. A group's place is the first element after its
+    // key, and changes at smaller keys never move it, so each chunk's
+    // places are all found before the chunk changes the tree. Sparse
+    // batches find them by interleaved descents from the root, whose
+    // cache misses overlap as in find_many; dense ones by finger search
+    // from the place before, which stays within the few levels between
+    // neighbouring keys. Each group then removes the last of its equal
+    // elements before its place and links its new ones in front of it,
+    // each in amortized O(1) through the insert hint.
+    template <typename O>
+    void applyGroups(const std::vector<BatchGroup>& groups, const std::vector<O*>& inserts) {
+        BasePtr head = this->headerPtr();
+        // An unknown count reads as huge and picks descents from the root.
+        bool dense = groups.size() * 4 >= this->nodeCount;
+        std::vector<BasePtr> places(std::min(groups.size(), batchChunk));
+        BasePtr finger = nullptr;
+        for (std::size_t first = 0; first < groups.size(); first += batchChunk) {
+            const BatchGroup* chunk = groups.data() + first;
+            std::size_t n = std::min(batchChunk, groups.size() - first);
+            if (dense) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    const T& key = *chunk[i].key;
+                    BasePtr x = finger ? this->lowerBoundFrom(finger, key) : this->lowerBoundNode(key);
+                    while (x != head && !this->less(key, this->keyOf(x)))
+                        x = this->successor(x);
+                    places[i] = finger = x;
+                }
+            } else {
+                this->upperBoundNodes(n, [&](std::size_t i) -> const T& { return *chunk[i].key; }, places.data());
+            }
+            for (std::size_t i = 0; i < n; ++i) {
+                const BatchGroup& group = chunk[i];
+                BasePtr x = places[i];
+                for (std::size_t r = group.removes; r > 0 && x != this->leftmost; --r) {
+                    BasePtr victim = this->predecessor(x);
+                    if (this->less(this->keyOf(victim), *group.key))
+                        break;
+                    this->removeNode(victim);
+                }
+                for (std::size_t k = group.insertsFirst; k < group.insertsLast; ++k) {
+                    NodePtr z = this->createNode(std::move(inserts[k]->value));
+                    BasePtr parent;
+                    bool asLeft;
+                    NodePtr existing;
+                    if (!this->hintedInsertParent(x, z->data, false, parent, asLeft, existing))
+                        parent = this->insertParent(z->data, asLeft);
+                    this->linkNode(z, parent, asLeft);
+                }
+            }
+        }
+    }
+
+    // The split-and-join version: split t around the middle group's key,
+    // apply that group to the equal piece, recurse on both sides, possibly
+    // in parallel, and join. New nodes are created up front, so nothing
+    // here throws while pieces are detached.
+    Piece applyGroups(Piece t, const BatchGroup* first, const BatchGroup* last, const std::vector<NodePtr>& nodes,
+                      std::size_t& freed, const Parallelism* par) {
+        if (first == last)
+            return t;
+        const BatchGroup* mid = first + (last - first) / 2;
+        Piece before, equal, after;
+        this->splitAround(t, *mid->key, before, equal, after);
+        for (std::size_t r = mid->removes; r > 0 && equal.root; --r) {
+            Piece rest;
+            BasePtr victim;
+            this->splitLast(equal, rest, victim);
+            this->destroyNode(victim);
+            ++freed;
+            equal = rest;
+        }
+        for (std::size_t i = mid->insertsFirst; i < mid->insertsLast; ++i)
+            equal = this->joinPieces(equal, nodes[i], Piece());
+        Piece l, r;
+        std::size_t freedRight = 0;
+        int height = std::max(t.blackHeight, static_cast<int>(std::bit_width(static_cast<std::size_t>(last - first))));
+        this->forkJoin(
+            par, height, [&] { l = applyGroups(before, first, mid, nodes, freed, par); },
+            [&] { r = applyGroups(after, mid + 1, last, nodes, freedRight, par); });
+        freed += freedRight;
+        return this->joinPieces(this->joinPieces(l, equal), r);
+    }
+
+    // Sorting the caller's ops through pointers costs a cache miss per
+    // comparison on large batches, so ops that copy as plain bytes are
+    // copied and sorted in place instead.
+    static constexpr bool copyBorrowedBatch = std::is_trivially_copyable_v<T>;
+
+    template <typename O>
+    void applyBatch(std::span<O> ops) {
+        if constexpr (std::is_const_v<O> && copyBorrowedBatch) {
+            std::vector<Op> copy(ops.begin(), ops.end());
+            applyBatch(std::span<Op>(copy));
+            return;
+        }
+        std::vector<O*> sorted = sortedBatch(ops, nullptr);
+        std::vector<BatchGroup> groups;
+        std::vector<O*> inserts;
+        collapseBatch(sorted, groups, inserts);
+        applyGroups(groups, inserts);
+    }
+
+    template <typename O>
+    void applyBatch(std::span<O> ops, const Parallelism& par) {
+        if constexpr (std::is_const_v<O> && copyBorrowedBatch) {
+            std::vector<Op> copy(ops.begin(), ops.end());
+            applyBatch(std::span<Op>(copy), par);
+            return;
+        }
+        std::vector<O*> sorted = sortedBatch(ops, &par);
+        std::vector<BatchGroup> groups;
+        std::vector<O*> inserts;
+        collapseBatch(sorted, groups, inserts);
+
+        const Parallelism* p = this->parallelOrNull(&par);
+        std::vector<NodePtr> nodes(inserts.size(), nullptr);
+        auto create = [&](std::size_t lo, std::size_t hi) {
+            for (std::size_t i = lo; i < hi; ++i)
+                nodes[i] = this->createNode(std::move(inserts[i]->value));
+        };
+        try {
+            if (p)
+                parallelFor(p->pool, 0, nodes.size(), p->cutoff, create);
+            else
+                create(0, nodes.size());
+        } catch (...) {
+            this->destroyNodes(nodes);
+            throw;
+        }
+        // The values behind insert keys may have just moved into the nodes.
+        for (BatchGroup& group : groups) {
+            if (group.insertsLast > group.insertsFirst)
+                group.key = &nodes[group.insertsFirst]->data;
+        }
+
+        std::size_t count = this->addCount(this->nodeCount, nodes.size());
+        std::size_t freed = 0;
+        Piece result = applyGroups(this->takePiece(), groups.data(), groups.data() + groups.size(), nodes, freed, p);
+        this->adoptPiece(result, this->subtractCount(count, freed));
+    }
+
+    template <typename K>
+    void findMany(std::span<const K> keys, std::span<const_iterator> out) const {
+        if (out.size() != keys.size())
+            throw std::invalid_argument("find_many: out must be as long as keys");
+        this->findManyNodes(keys.data(), keys.size(),
+                            [&](std::size_t i, NodePtr node) { out[i] = this->iteratorOrEnd(node); });
+    }
+
+public:
+    using Base::Base;
+
+    // Builds a perfectly balanced tree from sorted input in O(n) without
+    // comparing elements; verify adds one O(n) sortedness check that throws
+    // std::invalid_argument on unsorted input.
+    template <std::input_iterator It>
+    static RBTree from_sorted(It first, It last, bool verify = false, const Compare& compare = Compare(),
+                              const Allocator& allocator = Allocator()) {
+        RBTree tree(compare, allocator);
+        tree.buildFromSorted(first, last, verify, false);
+        return tree;
+    }
+
+    // Creates and links the nodes across par's pool.
+    template <std::random_access_iterator It>
+    static RBTree from_sorted(It first, It last, const Parallelism& par, bool verify = false,
+                              const Compare& compare = Compare(), const Allocator& allocator = Allocator()) {
+        RBTree tree(compare, allocator);
+        tree.buildFromSorted(first, last, verify, false, par);
+        return tree;
+    }
+
+    // Sorts the input first, then builds as from_sorted does. Equal
+    // elements keep their input order.
+    template <std::input_iterator It>
+    static RBTree from_unsorted(It first, It last, const Compare& compare = Compare(),
+                                const Allocator& allocator = Allocator()) {
+        RBTree tree(compare, allocator);
+        tree.buildFromUnsorted(first, last, false);
+        return tree;
+    }
+
+    // Sorts and links across par's pool.
+    template <std::input_iterator It>
+    static RBTree from_unsorted(It first, It last, const Parallelism& par, const Compare& compare = Compare(),
+                                const Allocator& allocator = Allocator()) {
+        RBTree tree(compare, allocator);
+        tree.buildFromUnsorted(first, last, false, &par);
+        return tree;
+    }
+
+    void insert(const T& data) {
+        insertValue(data);
+    }
+
+    void insert(T&& data) {
+        insertValue(std::move(data));
+    }
+
+    // Constructs the element in place inside its node.
+    template <typename... Args>
+    void emplace(Args&&... args) {
+        NodePtr z = this->createNode(std::forward<Args>(args)...);
+        bool asLeft;
+        BasePtr parent = this->insertParent(z->data, asLeft);
+        this->linkNode(z, parent, asLeft);
+    }
+
+    // Inserts as close before hint as possible. Costs amortized O(1) when
+    // the element belongs right before hint, so a stream of nearly sorted
+    // values inserted with the previous result (or end()) as the hint
+    // skips the descent; a wrong hint degrades to a plain insert.
+    iterator insert(const_iterator hint, const T& data) {
+        return linkNear(hint, this->createNode(data));
+    }
+
+    iterator insert(const_iterator hint, T&& data) {
+        return linkNear(hint, this->createNode(std::move(data)));
+    }
+
+    template <typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args) {
+        return linkNear(hint, this->createNode(std::forward<Args>(args)...));
+    }
+
+    NodePtr search(const T& data) const {
+        return this->findNode(data);
+    }
+
+    // out[i] = find(keys[i]) for every i, with the lookups interleaved so
+    // their memory latency overlaps; much faster than a loop over search
+    // once the tree no longer fits in cache. Throws std::invalid_argument
+    // if out is not as long as keys.
+    void find_many(std::span<const T> keys, std::span<const_iterator> out) const {
+        findMany(keys, out);
+    }
+
+    template <typename K>
+        requires TransparentCompare<Compare>
+    void find_many(std::span<const K> keys, std::span<const_iterator> out) const {
+        findMany(keys, out);
+    }
+
+    // Moves all of right's elements to the end of this tree in O(log n).
+    // No element of right may sort before the largest one here; otherwise
+    // throws std::invalid_argument and leaves both trees unchanged.
+    void join(RBTree&& right) {
+        this->joinWith(right, false);
+    }
+
+    // Moves the elements not less than key into the returned tree and keeps
+    // the rest, in O(log n). Without OrderStatistics the sizes of both
+    // halves are counted by the next size() on each.
+    RBTree split(const T& key) {
+        RBTree right(this->key_comp(), this->get_allocator());
+        this->splitInto(key, right);
+        return right;
+    }
+
+    // Set operations that consume other, in O(m log(n/m + 1)) comparisons for
+    // sizes m <= n. Small batches merge into large trees at a cost close to
+    // the batch size. Nodes move between the trees instead of being copied.
+    // Both trees must order elements the same way.
+
+    // Adds every element of other; equal elements from other go after the
+    // ones already here.
+    void union_with(RBTree&& other) {
+        this->uniteWith(other, false);
+    }
+
+    // Keeps the elements whose key also occurs in other.
+    void intersect_with(RBTree&& other) {
+        this->intersectWith(other);
+    }
+
+    // Drops the elements whose key occurs in other.
+    void difference_with(RBTree&& other) {
+        this->subtractWith(other);
+    }
+
+    // Parallel versions: subproblems above par.cutoff elements split across
+    // par's pool. The comparator must be safe to call concurrently, and
+    // with allocators other than std::allocator these run sequentially.
+    void union_with(RBTree&& other, const Parallelism& par) {
+        this->uniteWith(other, false, &par);
+    }
+
+    void intersect_with(RBTree&& other, const Parallelism& par) {
+        this->intersectWith(other, &par);
+    }
+
+    void difference_with(RBTree&& other, const Parallelism& par) {
+        this->subtractWith(other, &par);
+    }
+
+    // Applies a batch of inserts and removes in one in-order sweep. The
+    // batch is sorted stably by key. Removes then cancel earlier inserts
+    // of the same key, and the remaining keys are applied in order, each
+    // located near the one before. The result holds the same elements as
+    // applying the ops one at a time, with a remove taking the last of
+    // several equivalent elements. If constructing an element throws, the
+    // ops applied so far stay applied. The caller's ops are left as they
+    // were; inserted values are copied.
+    //
+    // Random batches of 10k to 1M ops on a tree of 1M ints run 1.5x to 2x
+    // faster than one insert or remove per op. That is short of 3x: each
+    // surviving op still pays for its own allocation and rebalancing, and
+    // sorting the batch takes a quarter to a half of the time.
+    void apply_batch(std::span<const Op> ops) {
+        applyBatch(ops);
+    }
+
+    // As above for a batch the tree may consume: it is sorted in place and
+    // inserted values are moved out of it.
+    void apply_batch(std::vector<Op>&& ops) {
+        applyBatch(std::span<Op>(ops));
+    }
+
+    // Parallel versions: sort and create the new nodes across par's pool,
+    // then split the tree around the middle key, recurse on both halves
+    // in parallel and join. If constructing an element throws, the tree
+    // is left unchanged.
+    void apply_batch(std::span<const Op> ops, const Parallelism& par) {
+        applyBatch(ops, par);
+    }
+
+    void apply_batch(std::vector<Op>&& ops, const Parallelism& par) {
+        applyBatch(std::span<Op>(ops), par);
+    }
+};
+
+template <typename T, typename Compare = std::less<>, typename Allocator = std::allocator<T>,
+          typename Augment = NoAugment>
+using RBSet = RBTree<T, Compare, Allocator, Augment>;
 
 #endif // RBTREE_H
@@ -0,0 +1,386 @@
+#ifndef SHARDEDRBTREE_H
+#define SHARDEDRBTREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ConcurrentRBTree.h"
+#include "RBTree.h"
+
+// Ordered multiset shared by many threads, split by key range into P
+// shards. Each shard is an RBTree behind its own mutex; shard i holds the
+// keys in [splitter i - 1, splitter i). A point operation routes through the
+// splitters without locking and then locks exactly one shard, so threads
+// working on different ranges do not contend. Range scans lock the shards
+// they cover in order and visit them one after another, which yields the
+// elements in sorted order.
+//
+// When a shard grows past twice its share as of the last rebalance, the
+// inserting thread moves elements between neighbouring shards with split
+// and join until every shard holds about size() / P, then publishes new
+// splitters. Old splitter arrays are reclaimed through EpochDomain, so
+// routing never takes a lock.
+template <typename T, typename Compare = std::less<>>
+class ShardedRBTree {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+
+    // Lock statistics of one shard since construction.
+    struct ShardStats {
+        size_type size;
+        std::uint64_t acquisitions;
+        std::uint64_t contended; // acquisitions that had to wait for another thread
+    };
+
+private:
+    // Subtree sizes let rebalancing find its cut points and split in
+    // O(log n).
+    using Tree = RBTree<T, Compare, std::allocator<T>, OrderStatistics>;
+
+    // Shards smaller than this never trigger a rebalance.
+    static constexpr size_type minShareToRebalance = 64;
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        Tree tree;
+        std::uint64_t generation = 0; // of the layout this shard's range comes from
+        std::uint64_t acquisitions = 0;
+        std::uint64_t contended = 0;
+
+        explicit Shard(const Compare& comp) : tree(comp) {}
+    };
+
+    // Immutable once published. Fewer than P - 1 splitters leave the
+    // trailing shards unused until the first rebalance.
+    struct Layout {
+        std::vector<T> splitters;
+        std::uint64_t generation;
+        size_type share; // elements per shard at the last rebalance
+    };
+
+    Compare comp;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<const Layout*> layout;
+    std::mutex rebalanceMutex;
+    std::vector<std::pair<std::uint64_t, const Layout*>> retired;
+
+    static EpochDomain& domain() {
+        return EpochDomain::instance();
+    }
+
+    template <typename K>
+    size_type route(const Layout& l, const K& key) const {
+        auto it = std::upper_bound(l.splitters.begin(), l.splitters.end(), key,
+                                   [this](const K& k, const T& splitter) { return compareLess(comp, k, splitter); });
+        return static_cast<size_type>(it - l.splitters.begin());
+    }
+
+    void lockShard(Shard& shard) const {
+        if (!shard.mutex.try_lock()) {
+            shard.mutex.lock();
+            ++shard.contended;
+        }
+        ++shard.acquisitions;
+    }
+
+    // Calls fn(shard, layout) with the shard that owns key locked. A
+    // rebalance between routing and locking shows up as a stale generation;
+    // then the routing is redone against the new splitters.
+    template <typename K, typename F>
+    decltype(auto) withShard(const K& key, F&& fn) const {
+        for (;;) {
+            EpochDomain::Guard guard(domain());
+            const Layout* l = layout.load(std::memory_order_seq_cst);
+            Shard& shard = *shards[route(*l, key)];
+            lockShard(shard);
+            std::unique_lock<std::mutex> lock(shard.mutex, std::adopt_lock);
+            if (shard.generation == l->generation)
+                return fn(shard, *l);
+        }
+    }
+
+    // Locks the shards that can hold keys in [lo, hi), in index order.
+    template <typename K>
+    std::vector<std::unique_lock<std::mutex>> lockRange(const K& lo, const K& hi, size_type& first) const {
+        for (;;) {
+            EpochDomain::Guard guard(domain());
+            const Layout* l = layout.load(std::memory_order_seq_cst);
+            first = route(*l, lo);
+            size_type last = std::max(first, route(*l, hi));
+            std::vector<std::unique_lock<std::mutex>> locks;
+            bool current = true;
+            for (size_type i = first; i <= last && current; ++i) {
+                lockShard(*shards[i]);
+                locks.emplace_back(shards[i]->mutex, std::adopt_lock);
+                current = shards[i]->generation == l->generation;
+            }
+            if (current)
+                return locks;
+        }
+    }
+
+    std::vector<std::unique_lock<std::mutex>> lockAll() const {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (auto& shard : shards) {
+            lockShard(*shard);
+            locks.emplace_back(shard->mutex, std::adopt_lock);
+        }
+        return locks;
+    }
+
+    // Moves elements between neighbours, left to right, until shards
+    // 0..i together hold (i + 1) * n / P of them. Splitting never cuts
+    // through a run of equal keys, so a shard may end up with a few more.
+    void redistribute() {
+        size_type p = shards.size();
+        size_type n = 0;
+        for (const auto& shard : shards)
+            n += shard->tree.size();
+        size_type before = 0; // elements in shards 0..i - 1
+        for (size_type i = 0; i + 1 < p; ++i) {
+            Tree& here = shards[i]->tree;
+            Tree& next = shards[i + 1]->tree;
+            size_type upTo = before + here.size();
+            size_type target = (i + 1) * n / p;
+            if (upTo > target && !here.empty()) {
+                size_type excess = std::min(upTo - target, here.size());
+                T cut = *here.select(here.size() - excess);
+                Tree moved = here.split(cut);
+                moved.join(std::move(next));
+                next = std::move(moved);
+            } else if (upTo < target && !next.empty()) {
+                size_type wanted = std::min(target - upTo, next.size());
+                Tree rest(comp);
+                if (wanted < next.size()) {
+                    T cut = *next.select(wanted);
+                    rest = next.split(cut);
+                }
+                here.join(std::move(next));
+                next = std::move(rest);
+            }
+            before += here.size();
+        }
+    }
+
+    // Requires every shard locked. An empty shard takes the splitter of
+    // its right neighbour, which leaves it an empty range; the last shard
+    // is never emptied.
+    std::vector<T> currentSplitters() const {
+        size_type p = shards.size();
+        std::vector<std::optional<T>> bounds(p > 0 ? p - 1 : 0);
+        for (size_type i = p - 1; i-- > 0;) {
+            const Tree& next = shards[i + 1]->tree;
+            if (!next.empty())
+                bounds[i] = next.min();
+            else if (i + 1 < bounds.size())
+                bounds[i] = bounds[i + 1];
+        }
+        std::vector<T> splitters;
+        for (auto& bound : bounds) {
+            if (!bound)
+                break;
+            splitters.push_back(std::move(*bound));
+        }
+        return splitters;
+    }
+
+    // Requires rebalanceMutex.
+    void rebalanceLocked() {
+        auto locks = lockAll();
+        const Layout* old = layout.load(std::memory_order_relaxed);
+        size_type n = 0;
+        for (const auto& shard : shards)
+            n += shard->tree.size();
+        if (n >= shards.size())
+            redistribute();
+        auto* next = new Layout{n >= shards.size() ? currentSplitters() : old->splitters, old->generation + 1,
+                                n / shards.size()};
+        for (auto& shard : shards)
+            shard->generation = next->generation;
+        layout.store(next, std::memory_order_seq_cst);
+        locks.clear();
+
+        retired.emplace_back(domain().current(), old);
+        std::uint64_t e = domain().tryAdvance();
+        std::erase_if(retired, [e](const auto& entry) {
+            if (entry.first + 2 > e)
+                return false;
+            delete entry.second;
+            return true;
+        });
+    }
+
+public:
+    explicit ShardedRBTree(size_type shardCount = std::thread::hardware_concurrency(),
+                           const Compare& compare = Compare())
+        : comp(compare), layout(new Layout{{}, 0, 0}) {
+        for (size_type i = 0; i < std::max<size_type>(shardCount, 1); ++i)
+            shards.push_back(std::make_unique<Shard>(compare));
+    }
+
+    ShardedRBTree(const ShardedRBTree&) = delete;
+    ShardedRBTree& operator=(const ShardedRBTree&) = delete;
+
+    // No other thread may still be using the tree.
+    ~ShardedRBTree() {
+        delete layout.load(std::memory_order_relaxed);
+        for (const auto& entry : retired)
+            delete entry.second;
+    }
+
+    void insert(const T& value) {
+        emplace(value);
+    }
+
+    void insert(T&& value) {
+        emplace(std::move(value));
+    }
+
+    template <typename U>
+    void emplace(U&& value) {
+        const T& key = value;
+        size_type shardSize, share;
+        std::uint64_t generation;
+        withShard(key, [&](Shard& shard, const Layout& l) {
+            shard.tree.insert(std::forward<U>(value));
+            shardSize = shard.tree.size();
+            share = l.share;
+            generation = l.generation;
+        });
+        // A skewed shard triggers a rebalance unless another thread is
+        // already running one or has done so since.
+        if (shardSize > 2 * std::max(share, minShareToRebalance)) {
+            std::unique_lock<std::mutex> lock(rebalanceMutex, std::try_to_lock);
+            if (lock.owns_lock() && layout.load(std::memory_order_relaxed)->generation == generation)
+                rebalanceLocked();
+        }
+    }
+
+    // Removes one element equivalent to key; returns whether there was one.
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    bool remove(const K& key) {
+        return withShard(key, [&](Shard& shard, const Layout&) {
+            auto it = shard.tree.find(key);
+            if (it == shard.tree.end())
+                return false;
+            shard.tree.erase(it);
+            return true;
+        });
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    bool contains(const K& key) const {
+        return withShard(key, [&](Shard& shard, const Layout&) { return shard.tree.contains(key); });
+    }
+
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    size_type count(const K& key) const {
+        return withShard(key, [&](Shard& shard, const Layout&) { return shard.tree.count(key); });
+    }
+
+    // A copy of the first element equivalent to key, if any.
+    template <typename K = T>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    std::optional<T> find(const K& key) const {
+        return withShard(key, [&](Shard& shard, const Layout&) -> std::optional<T> {
+            auto it = shard.tree.find(key);
+            if (it == shard.tree.end())
+                return std::nullopt;
+            return *it;
+        });
+    }
+
+    // Calls fn on every element with a key in [lo, hi), in order. The covered shards
+    // stay locked throughout, so the scan sees one consistent state; fn must
+    // not call back into the tree.
+    template <typename K, typename F>
+        requires std::same_as<K, T> || TransparentCompare<Compare>
+    void for_each_in_range(const K& lo, const K& hi, F&& fn) const {
+        size_type first;
+        auto locks = lockRange(lo, hi, first);
+        for (size_type i = 0; i < locks.size(); ++i)
+            std::as_const(shards[first + i]->tree).for_each_in_range(lo, hi, fn);
+    }
+
+    // Calls fn on every element in order, with all shards locked.
+    template <typename F>
+    void for_each(F&& fn) const {
+        auto locks = lockAll();
+        for (const auto& shard : shards)
+            for (const T& value : std::as_const(shard->tree))
+                fn(value);
+    }
+
+    // Sums the shards one at a time, so under concurrent updates the result
+    // is only approximate.
+    size_type size() const {
+        size_type n = 0;
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            n += shard->tree.size();
+        }
+        return n;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_type shard_count() const {
+        return shards.size();
+    }
+
+    // Evens out the shards now instead of waiting for one to grow skewed.
+    void rebalance() {
+        std::lock_guard<std::mutex> lock(rebalanceMutex);
+        rebalanceLocked();
+    }
+
+    // One entry per shard, in key order.
+    std::vector<ShardStats> stats() const {
+        std::vector<ShardStats> result;
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            result.push_back({shard->tree.size(), shard->acquisitions, shard->contended});
+        }
+        return result;
+    }
+
+    // Checks every shard and that each lies inside its splitter range.
+    bool isValid() const {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (auto& shard : shards)
+            locks.emplace_back(shard->mutex);
+        const Layout* l = layout.load(std::memory_order_seq_cst);
+        for (size_type i = 0; i < shards.size(); ++i) {
+            const Tree& tree = shards[i]->tree;
+            if (!tree.isValid() || shards[i]->generation != l->generation)
+                return false;
+            if (tree.empty())
+                continue;
+            if (i > l->splitters.size())
+                return false;
+            if (i > 0 && compareLess(comp, tree.min(), l->splitters[i - 1]))
+                return false;
+            if (i < l->splitters.size() && !compareLess(comp, tree.max(), l->splitters[i]))
+                return false;
+        }
+        return true;
+    }
+};
+
+#endif // SHARDEDRBTREE_H
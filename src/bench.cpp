@@ -0,0 +1,477 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "ConcurrentRBTree.h"
+#include "FrozenBTree.h"
+#include "FrozenTree.h"
+#include "RBTree.h"
+#include "ShardedRBTree.h"
+
+// Runs fn once and returns the elapsed wall-clock time in milliseconds.
+template <typename F>
+double timeMs(F&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+void report(const std::string& name, double ms, const std::string& detail = "") {
+    std::cout << "  " << name << ": " << ms << " ms";
+    if (!detail.empty())
+        std::cout << " (" << detail << ")";
+    std::cout << std::endl;
+}
+
+std::vector<std::string> randomStrings(std::size_t count, std::size_t length) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::vector<std::string> result(count);
+    for (auto& s : result) {
+        s.resize(length);
+        for (auto& c : s)
+            c = static_cast<char>(letter(rng));
+    }
+    return result;
+}
+
+// String payload that counts deep copies.
+struct CountedString {
+    static inline long copies = 0;
+    std::string value;
+
+    explicit CountedString(std::string text) : value(std::move(text)) {}
+    CountedString(const CountedString& other) : value(other.value) { ++copies; }
+    CountedString(CountedString&&) noexcept = default;
+
+    bool operator<(const CountedString& other) const { return value < other.value; }
+    bool operator==(const CountedString& other) const { return value == other.value; }
+};
+
+void benchInsertCopies() {
+    constexpr std::size_t count = 200000;
+    std::cout << "insert/emplace of " << count << " 64-byte strings" << std::endl;
+    std::vector<std::string> keys = randomStrings(count, 64);
+
+    {
+        std::vector<CountedString> values;
+        for (const auto& key : keys)
+            values.emplace_back(key);
+        RBTree<CountedString> tree;
+        CountedString::copies = 0;
+        double ms = timeMs([&] {
+            for (const auto& value : values)
+                tree.insert(value);
+        });
+        report("insert(const T&)", ms, std::to_string(CountedString::copies) + " copies");
+    }
+    {
+        std::vector<CountedString> values;
+        for (const auto& key : keys)
+            values.emplace_back(key);
+        RBTree<CountedString> tree;
+        CountedString::copies = 0;
+        double ms = timeMs([&] {
+            for (auto& value : values)
+                tree.insert(std::move(value));
+        });
+        report("insert(T&&)", ms, std::to_string(CountedString::copies) + " copies");
+    }
+    {
+        RBTree<CountedString> tree;
+        CountedString::copies = 0;
+        double ms = timeMs([&] {
+            for (auto& key : keys)
+                tree.emplace(std::move(key));
+        });
+        report("emplace(Args&&...)", ms, std::to_string(CountedString::copies) + " copies");
+    }
+}
+
+void benchBulkLoad() {
+    constexpr int count = 2000000;
+    std::cout << "building a tree of " << count << " ints" << std::endl;
+    std::vector<int> sorted(count);
+    for (int i = 0; i < count; ++i)
+        sorted[i] = i;
+    std::vector<int> shuffled = sorted;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(7));
+
+    report("insert x n (sorted input)", timeMs([&] {
+        RBTree<int> tree;
+        for (int value : sorted)
+            tree.insert(value);
+    }));
+    report("from_sorted", timeMs([&] { RBTree<int>::from_sorted(sorted.begin(), sorted.end()); }));
+    report("from_sorted (verified)", timeMs([&] { RBTree<int>::from_sorted(sorted.begin(), sorted.end(), true); }));
+    report("insert x n (shuffled input)", timeMs([&] {
+        RBTree<int> tree;
+        for (int value : shuffled)
+            tree.insert(value);
+    }));
+    report("from_unsorted", timeMs([&] { RBTree<int>::from_unsorted(shuffled.begin(), shuffled.end()); }));
+    WorkStealingPool pool;
+    report("from_unsorted (pool)", timeMs([&] {
+        RBTree<int>::from_unsorted(shuffled.begin(), shuffled.end(), Parallelism{pool});
+    }), std::to_string(pool.size()) + " threads");
+}
+
+void benchHintedInsert() {
+    constexpr int count = 2000000;
+    std::cout << "inserting " << count << " nearly sorted ints" << std::endl;
+    // Ascending with every 16th pair of neighbours swapped.
+    std::vector<int> nearlySorted(count);
+    for (int i = 0; i < count; ++i)
+        nearlySorted[i] = i;
+    for (int i = 0; i + 1 < count; i += 16)
+        std::swap(nearlySorted[i], nearlySorted[i + 1]);
+
+    report("insert", timeMs([&] {
+        RBTree<int> tree;
+        for (int value : nearlySorted)
+            tree.insert(value);
+    }));
+    report("insert(end(), value)", timeMs([&] {
+        RBTree<int> tree;
+        for (int value : nearlySorted)
+            tree.insert(tree.end(), value);
+    }));
+    report("std::multiset insert(end(), value)", timeMs([&] {
+        std::multiset<int> set;
+        for (int value : nearlySorted)
+            set.insert(set.end(), value);
+    }));
+}
+
+void benchMergeBatch() {
+    constexpr int count = 1000000;
+    constexpr int batchSize = 1000;
+    std::cout << "merging a batch of " << batchSize << " ints into " << count << std::endl;
+    std::vector<int> sorted(count);
+    for (int i = 0; i < count; ++i)
+        sorted[i] = i * 2;
+    std::vector<int> batch(batchSize);
+    for (int i = 0; i < batchSize; ++i)
+        batch[i] = i * (2 * count / batchSize) + 1;
+
+    auto tree = RBTree<int>::from_sorted(sorted.begin(), sorted.end());
+    report("insert x batch", timeMs([&] {
+        for (int value : batch)
+            tree.insert(value);
+    }));
+    tree = RBTree<int>::from_sorted(sorted.begin(), sorted.end());
+    auto delta = RBTree<int>::from_sorted(batch.begin(), batch.end());
+    report("union_with", timeMs([&] { tree.union_with(std::move(delta)); }));
+}
+
+// Thread sweep for the join-based parallel operations: doubling thread
+// counts up to the hardware concurrency.
+void benchParallelSetOperations() {
+    constexpr int count = 2000000;
+    std::cout << "parallel build and union of two " << count << "-int trees" << std::endl;
+    std::vector<int> evens(count), odds(count);
+    for (int i = 0; i < count; ++i) {
+        evens[i] = i * 2;
+        odds[i] = i * 2 + 1;
+    }
+
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+        WorkStealingPool pool(threads);
+        Parallelism par{pool};
+        std::string detail = std::to_string(threads) + " threads";
+        RBTree<int> a, b;
+        report("from_sorted x 2", timeMs([&] {
+            a = RBTree<int>::from_sorted(evens.begin(), evens.end(), par);
+            b = RBTree<int>::from_sorted(odds.begin(), odds.end(), par);
+        }), detail);
+        report("union_with", timeMs([&] { a.union_with(std::move(b), par); }), detail);
+        if (threads == maxThreads)
+            break;
+    }
+}
+
+// 98% lookups and 2% updates from every thread, against an RBTree behind a
+// std::shared_mutex. Reports millions of operations per second.
+template <typename Lookup, typename Update>
+double mixedThroughput(unsigned threads, int keys, Lookup lookup, Update update) {
+    constexpr int opsPerThread = 200000;
+    double ms = timeMs([&] {
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937 rng(t);
+                std::uniform_int_distribution<int> key(0, keys - 1);
+                for (int i = 0; i < opsPerThread; ++i) {
+                    if (i % 50 == 0)
+                        update(key(rng));
+                    else
+                        lookup(key(rng));
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+    });
+    return threads * opsPerThread / ms / 1000;
+}
+
+void benchConcurrentReads() {
+    constexpr int keys = 100000;
+    std::cout << "98% reads / 2% writes on " << keys << " ints" << std::endl;
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+        std::string detail = std::to_string(threads) + " threads";
+
+        RBTree<int> locked;
+        std::shared_mutex mutex;
+        for (int i = 0; i < keys; i += 2)
+            locked.insert(i);
+        double mops = mixedThroughput(threads, keys,
+            [&](int key) {
+                std::shared_lock<std::shared_mutex> lock(mutex);
+                return locked.contains(key);
+            },
+            [&](int key) {
+                std::unique_lock<std::shared_mutex> lock(mutex);
+                if (locked.contains(key))
+                    locked.remove(key);
+                else
+                    locked.insert(key);
+            });
+        std::cout << "  RBTree + shared_mutex: " << mops << " Mops/s (" << detail << ")" << std::endl;
+
+        ConcurrentRBTree<int> concurrent;
+        for (int i = 0; i < keys; i += 2)
+            concurrent.insert(i);
+        mops = mixedThroughput(threads, keys, [&](int key) { return concurrent.contains(key); },
+                               [&](int key) {
+                                   if (!concurrent.remove(key))
+                                       concurrent.insert(key);
+                               });
+        std::cout << "  ConcurrentRBTree: " << mops << " Mops/s (" << detail << ")" << std::endl;
+        if (threads == maxThreads)
+            break;
+    }
+}
+
+// Mixed inserts, removes and lookups on uniformly random keys, with one
+// shard per hardware thread. Reports throughput and how many shard lock
+// acquisitions had to wait.
+void benchShardedMixed() {
+    constexpr int keys = 1000000;
+    constexpr int opsPerThread = 200000;
+    std::cout << "mixed insert/remove/search on " << keys << " ints" << std::endl;
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+        ShardedRBTree<int> tree(maxThreads);
+        for (int i = 0; i < keys; i += 2)
+            tree.insert(i);
+        tree.rebalance();
+        auto baseline = tree.stats();
+        double ms = timeMs([&] {
+            std::vector<std::thread> workers;
+            for (unsigned t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t] {
+                    std::mt19937 rng(t);
+                    std::uniform_int_distribution<int> key(0, keys - 1);
+                    for (int i = 0; i < opsPerThread; ++i) {
+                        int k = key(rng);
+                        if (i % 4 == 0)
+                            tree.insert(k);
+                        else if (i % 4 == 1)
+                            tree.remove(k);
+                        else
+                            tree.contains(k);
+                    }
+                });
+            }
+            for (auto& worker : workers)
+                worker.join();
+        });
+        std::uint64_t acquisitions = 0, contended = 0;
+        auto stats = tree.stats();
+        for (std::size_t i = 0; i < stats.size(); ++i) {
+            acquisitions += stats[i].acquisitions - baseline[i].acquisitions;
+            contended += stats[i].contended - baseline[i].contended;
+        }
+        report("ShardedRBTree", ms,
+               std::to_string(threads) + " threads, " + std::to_string(threads * opsPerThread / ms / 1000) +
+                   " Mops/s, " + std::to_string(contended) + " of " + std::to_string(acquisitions) +
+                   " lock acquisitions contended");
+        if (threads == maxThreads)
+            break;
+    }
+}
+
+void benchApplyBatch() {
+    constexpr int count = 1000000;
+    std::cout << "applying random batches to a tree of " << count << " ints" << std::endl;
+    using Op = RBTree<int>::Op;
+    std::vector<int> sorted(count);
+    for (int i = 0; i < count; ++i)
+        sorted[i] = i * 2;
+    WorkStealingPool pool;
+    Parallelism par{pool};
+
+    for (int batchSize : {10000, 100000, 1000000}) {
+        std::mt19937 rng(batchSize);
+        std::uniform_int_distribution<int> key(0, 2 * count);
+        std::vector<Op> batch(batchSize);
+        for (auto& op : batch)
+            op = {rng() % 2 ? Op::Insert : Op::Remove, key(rng)};
+        std::string detail = std::to_string(batchSize) + " ops";
+
+        auto tree = RBTree<int>::from_sorted(sorted.begin(), sorted.end());
+        report("insert/remove x batch", timeMs([&] {
+            for (const Op& op : batch) {
+                if (op.kind == Op::Insert)
+                    tree.insert(op.value);
+                else
+                    tree.remove(op.value);
+            }
+        }), detail);
+        tree = RBTree<int>::from_sorted(sorted.begin(), sorted.end());
+        report("apply_batch", timeMs([&] { tree.apply_batch(batch); }), detail);
+        tree = RBTree<int>::from_sorted(sorted.begin(), sorted.end());
+        std::vector<Op> ops = batch;
+        report("apply_batch (consumed)", timeMs([&] { tree.apply_batch(std::move(ops)); }), detail);
+        tree = RBTree<int>::from_sorted(sorted.begin(), sorted.end());
+        report("apply_batch (parallel)", timeMs([&] { tree.apply_batch(batch, par); }),
+               detail + ", " + std::to_string(pool.size()) + " threads");
+    }
+}
+
+// Random lookups against trees below and well above the last-level cache.
+void benchFindMany() {
+    constexpr int lookups = 1000000;
+    for (int count : {1 << 16, 1 << 20, 1 << 24}) {
+        std::cout << "looking up " << lookups << " random ints in a tree of " << count << std::endl;
+        std::vector<int> sorted(count);
+        for (int i = 0; i < count; ++i)
+            sorted[i] = i * 2;
+        auto tree = RBTree<int>::from_sorted(sorted.begin(), sorted.end());
+        std::mt19937 rng(count);
+        std::uniform_int_distribution<int> key(0, 2 * count);
+        std::vector<int> keys(lookups);
+        for (int& k : keys)
+            k = key(rng);
+        std::string detail = std::to_string(tree.size() * RBTree<int>::nodeBytes >> 20) + " MiB of nodes";
+
+        std::size_t hits = 0;
+        report("search x keys", timeMs([&] {
+            for (int k : keys)
+                hits += tree.search(k) != nullptr;
+        }), detail);
+        std::vector<RBTree<int>::const_iterator> out(keys.size());
+        report("find_many", timeMs([&] { tree.find_many(keys, out); }), detail);
+        std::size_t manyHits = std::count_if(out.begin(), out.end(), [&](auto it) { return it != tree.end(); });
+        if (manyHits != hits)
+            std::cout << "  mismatch: " << manyHits << " vs " << hits << " hits" << std::endl;
+    }
+}
+
+// Random lookups in the live tree and in its frozen Eytzinger copy.
+void benchFrozenLookup() {
+    constexpr int lookups = 1000000;
+    for (int count : {1 << 16, 1 << 20, 1 << 24}) {
+        std::cout << "looking up " << lookups << " random ints in a frozen tree of " << count << std::endl;
+        std::vector<int> sorted(count);
+        for (int i = 0; i < count; ++i)
+            sorted[i] = i * 2;
+        auto tree = RBTree<int>::from_sorted(sorted.begin(), sorted.end());
+        std::mt19937 rng(count);
+        std::uniform_int_distribution<int> key(0, 2 * count);
+        std::vector<int> keys(lookups);
+        for (int& k : keys)
+            k = key(rng);
+
+        FrozenTree<int> frozen;
+        report("FrozenTree(tree)", timeMs([&] { frozen = FrozenTree(tree); }));
+        std::size_t hits = 0, frozenHits = 0;
+        report("RBTree::contains", timeMs([&] {
+            for (int k : keys)
+                hits += tree.contains(k);
+        }));
+        report("FrozenTree::contains", timeMs([&] {
+            for (int k : keys)
+                frozenHits += frozen.contains(k);
+        }));
+        long sum = 0;
+        report("FrozenTree::lower_bound", timeMs([&] {
+            for (int k : keys) {
+                auto it = frozen.lower_bound(k);
+                sum += it == frozen.end() ? 0 : *it;
+            }
+        }));
+        if (hits != frozenHits || sum == 0)
+            std::cout << "  mismatch: " << frozenHits << " vs " << hits << " hits" << std::endl;
+    }
+}
+
+// Random lookups in FrozenBTree on each instruction set, next to the
+// Eytzinger copy. The largest set is built straight from a sorted vector,
+// as its RBTree would not fit in memory here. With 1M lookups, ms equals
+// ns per lookup.
+void benchFrozenBTree() {
+    using Isa = FrozenBTree<int>::Isa;
+    constexpr int lookups = 1000000;
+    for (int count : {1 << 16, 1 << 20, 1 << 24, 1 << 28}) {
+        std::cout << "looking up " << lookups << " random ints in a frozen B-tree of " << count << std::endl;
+        std::vector<int> sorted(count);
+        for (int i = 0; i < count; ++i)
+            sorted[i] = i * 2;
+        std::mt19937 rng(count);
+        std::uniform_int_distribution<int> key(0, 2 * count - 1);
+        std::vector<int> keys(lookups);
+        for (int& k : keys)
+            k = key(rng);
+        std::size_t hits = 0;
+        if (count <= 1 << 24) {
+            auto tree = RBTree<int>::from_sorted(sorted.begin(), sorted.end());
+            FrozenTree eytzinger(tree);
+            report("FrozenTree::contains", timeMs([&] {
+                for (int k : keys)
+                    hits += eytzinger.contains(k);
+            }));
+        }
+        for (Isa isa : {Isa::Scalar, Isa::Sse42, Isa::Avx2}) {
+            FrozenBTree<int> frozen(sorted.begin(), sorted.size(), isa);
+            if (frozen.isa() != isa)
+                continue;
+            std::string detail = isa == Isa::Avx2 ? "AVX2" : isa == Isa::Sse42 ? "SSE4.2" : "scalar";
+            std::size_t frozenHits = 0;
+            report("FrozenBTree::contains", timeMs([&] {
+                for (int k : keys)
+                    frozenHits += frozen.contains(k);
+            }), detail);
+            std::vector<FrozenBTree<int>::const_iterator> out(keys.size());
+            report("FrozenBTree::find_many", timeMs([&] { frozen.find_many(keys, out); }), detail);
+            if (hits != 0 && frozenHits != hits)
+                std::cout << "  mismatch: " << frozenHits << " vs " << hits << " hits" << std::endl;
+        }
+    }
+}
+
+int main() {
+    benchInsertCopies();
+    benchBulkLoad();
+    benchHintedInsert();
+    benchMergeBatch();
+    benchApplyBatch();
+    benchFindMany();
+    benchFrozenLookup();
+    benchFrozenBTree();
+    benchParallelSetOperations();
+    benchConcurrentReads();
+    benchShardedMixed();
+    return 0;
+}
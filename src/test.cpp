@@ -1,6 +1,90 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <compare>
+#include <cstddef>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "ArenaRBTree.h"
+#include "ConcurrentRBTree.h"
+#include "FrozenBTree.h"
+#include "FrozenTree.h"
+#include "NodePool.h"
+#include "PersistentRBTree.h"
+#include "RBMap.h"
 #include "RBTree.h"
+#include "ShardedRBTree.h"
+
+// Counts every call into the global heap, from any thread.
+static std::atomic<long> heapAllocations = 0;
+static std::atomic<long> heapFrees = 0;
+
+// Blocks currently allocated from the global heap.
+long liveHeapBlocks() {
+    return heapAllocations - heapFrees;
+}
+
+void* operator new(std::size_t size) {
+    ++heapAllocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    ++heapAllocations;
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept {
+    if (p)
+        ++heapFrees;
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    if (p)
+        ++heapFrees;
+    std::free(p);
+}
+
+// Payload that counts how many instances are alive.
+struct Tracked {
+    static inline long live = 0;
+    int value;
+
+    Tracked(int v) : value(v) { ++live; }
+    Tracked(const Tracked& other) : value(other.value) { ++live; }
+    ~Tracked() { --live; }
+
+    bool operator<(const Tracked& other) const { return value < other.value; }
+    bool operator==(const Tracked& other) const { return value == other.value; }
+};
+
+// Payload that counts copies and moves.
+struct CopyCounter {
+    static inline int copies = 0;
+    static inline int moves = 0;
+    std::string key;
+
+    explicit CopyCounter(std::string k) : key(std::move(k)) {}
+    CopyCounter(const char* first, std::size_t length) : key(first, length) {}
+    CopyCounter(const CopyCounter& other) : key(other.key) { ++copies; }
+    CopyCounter(CopyCounter&& other) noexcept : key(std::move(other.key)) { ++moves; }
+
+    bool operator<(const CopyCounter& other) const { return key < other.key; }
+    bool operator==(const CopyCounter& other) const { return key == other.key; }
+};
 
 void testInsertion() {
     RBTree<int> tree;
@@ -56,10 +140,1335 @@ void testSearch() {
     std::cout << "Test: Search successful." << std::endl;
 }
 
+void testCopyAndMove() {
+    RBTree<int> tree;
+    for (int i = 0; i < 100; ++i)
+        tree.insert(i);
+
+    RBTree<int> copy(tree);
+    copy.remove(50);
+    assert(tree.search(50) != nullptr);
+    assert(copy.search(50) == nullptr);
+
+    RBTree<int> moved(std::move(copy));
+    assert(moved.search(49) != nullptr);
+    assert(moved.search(50) == nullptr);
+
+    tree = moved;
+    assert(tree.search(50) == nullptr);
+
+    std::cout << "Test: Copy and move successful." << std::endl;
+}
+
+void testRemoveAll() {
+    RBTree<int> tree;
+    for (int i = 0; i < 1000; ++i)
+        tree.insert((i * 37) % 1000);
+    assert(tree.isValid());
+    for (int i = 0; i < 1000; ++i) {
+        tree.remove((i * 91) % 1000);
+        assert(tree.search((i * 91) % 1000) == nullptr);
+        assert(i % 50 != 0 || tree.isValid());
+    }
+    for (int i = 0; i < 1000; ++i)
+        assert(tree.search(i) == nullptr);
+
+    std::cout << "Test: Remove all successful." << std::endl;
+}
+
+void testChurnMemory() {
+    constexpr int keys = 10000;
+    auto churn = [](RBTree<Tracked>& tree, int rounds) {
+        for (int i = 0; i < rounds; ++i) {
+            int key = static_cast<int>((i * 7919LL) % keys);
+            tree.remove(key);
+            tree.insert(key);
+        }
+    };
+
+    {
+        RBTree<Tracked> tree;
+        for (int i = 0; i < keys; ++i)
+            tree.insert(i);
+        assert(Tracked::live == keys);
+
+        churn(tree, 100000);
+        assert(Tracked::live == keys);
+        [[maybe_unused]] long blocksBefore = liveHeapBlocks();
+
+        churn(tree, 500000);
+        assert(Tracked::live == keys);
+
+        // Every erased node goes back to the heap before its key returns.
+        assert(liveHeapBlocks() == blocksBefore);
+
+        tree.clear();
+        assert(Tracked::live == 0);
+        assert(tree.search(0) == nullptr);
+        for (int i = 0; i < keys; ++i)
+            tree.insert(i);
+    }
+    assert(Tracked::live == 0);
+
+    std::cout << "Test: Churn memory successful." << std::endl;
+}
+
+void testPoolAllocator() {
+    RBTree<int, std::less<>, PoolAllocator<int>> tree(PoolAllocator<int>(256));
+    for (int i = 0; i < 5000; ++i)
+        tree.insert(i);
+    [[maybe_unused]] std::size_t slabs = tree.get_allocator().resource().slabCount();
+    assert(slabs > 0);
+
+    [[maybe_unused]] long allocationsBefore = heapAllocations;
+    for (int i = 0; i < 200000; ++i) {
+        tree.remove(i % 5000);
+        tree.insert(i % 5000);
+    }
+    assert(heapAllocations == allocationsBefore);
+    assert(tree.get_allocator().resource().slabCount() == slabs);
+
+    RBTree<int, std::less<>, PoolAllocator<int>> copy(tree);
+    assert(!(copy.get_allocator() == tree.get_allocator()));
+    assert(copy.search(4999) != nullptr);
+
+    RBTree<int, std::less<>, PoolAllocator<int>> moved(std::move(copy));
+    assert(moved.search(4999) != nullptr);
+
+    // A moved-from tree keeps a live pool to allocate from.
+    assert(copy.get_allocator() == moved.get_allocator());
+    assert(copy.get_allocator().resource().blocksPerSlab() == 256);
+    copy.insert(1);
+    assert(copy.search(1) != nullptr);
+    PoolAllocator<int> source(64);
+    PoolAllocator<int> target(std::move(source));
+    assert(source == target && source.resource().blocksPerSlab() == 64);
+
+    std::cout << "Test: Pool allocator successful." << std::endl;
+}
+
+void testPmrAllocator() {
+    static std::byte buffer[1 << 16];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+
+    [[maybe_unused]] long allocationsBefore = heapAllocations;
+    {
+        RBTree<int, std::less<>, std::pmr::polymorphic_allocator<int>> tree(&arena);
+        for (int i = 0; i < 500; ++i)
+            tree.insert(i);
+        tree.remove(250);
+        assert(tree.search(250) == nullptr);
+        assert(tree.search(249) != nullptr);
+    }
+    assert(heapAllocations == allocationsBefore);
+
+    std::cout << "Test: Pmr allocator successful." << std::endl;
+}
+
+void testArenaTree() {
+    static_assert(ArenaRBTree<int>::nodeBytes == 16);
+
+    ArenaRBTree<int> tree;
+    tree.reserve(1000);
+    for (int i = 0; i < 1000; ++i)
+        tree.insert((i * 37) % 1000);
+    for (int i = 0; i < 1000; ++i)
+        assert(tree.search(i) != nullptr && *tree.search(i) == i);
+    assert(tree.search(1000) == nullptr);
+
+    for (int i = 0; i < 1000; i += 2)
+        tree.remove(i);
+    for (int i = 0; i < 1000; ++i)
+        assert((tree.search(i) != nullptr) == (i % 2 == 1));
+
+    // Erased slots are reused before the arena grows.
+    for (int i = 0; i < 1000; i += 2)
+        tree.insert(i);
+    for (int i = 0; i < 1000; ++i)
+        assert(tree.search(i) != nullptr);
+
+    tree.clear();
+    assert(tree.search(1) == nullptr);
+
+    // Only held elements are alive: the null slot holds none, erasing
+    // destroys at once, and copies and reallocation carry exactly these.
+    Tracked::live = 0;
+    {
+        ArenaRBTree<Tracked> tracked;
+        tracked.insert(Tracked(0));
+        assert(Tracked::live == 1);
+        for (int i = 1; i < 100; ++i)
+            tracked.insert(Tracked(i));
+        for (int i = 0; i < 100; i += 2)
+            tracked.remove(Tracked(i));
+        assert(Tracked::live == 50);
+        ArenaRBTree<Tracked> copy = tracked;
+        assert(Tracked::live == 100 && copy.search(Tracked(51)) && !copy.search(Tracked(50)));
+        for (int i = 0; i < 100; i += 2)
+            copy.insert(Tracked(i));
+        assert(Tracked::live == 150 && copy.search(Tracked(50)));
+    }
+    assert(Tracked::live == 0);
+
+    std::cout << "Test: Arena tree successful." << std::endl;
+}
+
+void testNodeLayout() {
+    // Links and color share three words; only the payload adds to that.
+    static_assert(RBTree<long>::nodeBytes == 4 * sizeof(void*));
+
+    RBTree<long> tree;
+    for (long i = 0; i < 2000; ++i)
+        tree.insert((i * 7919) % 2000);
+    assert(tree.isValid());
+    for (long i = 0; i < 2000; i += 3)
+        tree.remove(i);
+    assert(tree.isValid());
+
+    std::cout << "Test: Node layout successful." << std::endl;
+}
+
+void testInsertCopies() {
+    RBTree<CopyCounter> tree;
+    CopyCounter lvalue("lvalue");
+
+    CopyCounter::copies = CopyCounter::moves = 0;
+    tree.insert(lvalue);
+    assert(CopyCounter::copies == 1 && CopyCounter::moves == 0);
+
+    CopyCounter::copies = CopyCounter::moves = 0;
+    tree.insert(CopyCounter("rvalue"));
+    assert(CopyCounter::copies == 0 && CopyCounter::moves == 1);
+
+    CopyCounter::copies = CopyCounter::moves = 0;
+    tree.emplace("emplaced", 8);
+    assert(CopyCounter::copies == 0 && CopyCounter::moves == 0);
+
+    assert(tree.isValid());
+
+    std::cout << "Test: Insert copies successful." << std::endl;
+}
+
+void testHeterogeneousLookup() {
+    RBTree<std::string> tree;
+    std::string prefix(40, 'k'); // long enough to defeat the small-string buffer
+    for (int i = 0; i < 100; ++i)
+        tree.insert(prefix + std::to_string(i));
+    tree.insert(prefix + "7");
+
+    std::string hitKey = prefix + "42";
+    std::string missKey = prefix + "x";
+    std::string dupKey = prefix + "7";
+    std::string_view hit = hitKey, miss = missKey, dup = dupKey;
+
+    [[maybe_unused]] long allocationsBefore = heapAllocations;
+    [[maybe_unused]] auto it = tree.find(hit);
+    [[maybe_unused]] bool found = tree.contains(hit);
+    [[maybe_unused]] bool missing = !tree.contains(miss);
+    [[maybe_unused]] bool atEnd = tree.find(miss) == tree.end();
+    [[maybe_unused]] std::size_t dupCount = tree.count(dup);
+    [[maybe_unused]] std::size_t missCount = tree.count(miss);
+    assert(heapAllocations == allocationsBefore);
+
+    assert(it != tree.end() && *it == hitKey && it->size() == hitKey.size());
+    assert(found && missing && atEnd);
+    assert(dupCount == 2 && missCount == 0);
+
+    std::cout << "Test: Heterogeneous lookup successful." << std::endl;
+}
+
+// Three-way comparator that counts its calls.
+struct CountingCompare {
+    static inline long calls = 0;
+
+    std::strong_ordering operator()(int a, int b) const {
+        ++calls;
+        return a <=> b;
+    }
+};
+
+void testCustomCompare() {
+    // Stateless comparators and allocators take no space next to the
+    // three-word header, the cached leftmost node and the element count.
+    static_assert(sizeof(RBTree<int>) == 5 * sizeof(void*));
+    static_assert(sizeof(RBTree<int, CountingCompare>) == 5 * sizeof(void*));
+
+    RBTree<int, std::greater<>> descending;
+    for (int i = 0; i < 100; ++i)
+        descending.insert(i);
+    assert(descending.isValid());
+    assert(descending.contains(42) && !descending.contains(100));
+    descending.remove(42);
+    assert(!descending.contains(42));
+
+    // A hit or miss costs one comparison per level visited. upper_bound
+    // tests one less-than per level all the way down, so its count is the
+    // number of levels on the path: a miss takes exactly that path and a
+    // hit stops somewhere along it.
+    RBTree<int, CountingCompare> tree;
+    for (int i = 0; i < 1023; ++i)
+        tree.insert(i * 2);
+    CountingCompare::calls = 0;
+    tree.upper_bound(512);
+    [[maybe_unused]] long levels = CountingCompare::calls;
+    CountingCompare::calls = 0;
+    [[maybe_unused]] bool hit = tree.contains(512);
+    [[maybe_unused]] long hitCalls = CountingCompare::calls;
+    CountingCompare::calls = 0;
+    [[maybe_unused]] bool miss = tree.contains(513);
+    [[maybe_unused]] long missCalls = CountingCompare::calls;
+    assert(hit && !miss);
+    assert(hitCalls <= levels && missCalls == levels);
+
+    std::cout << "Test: Custom compare successful." << std::endl;
+}
+
+void testMap() {
+    RBMap<std::string, int> map;
+    map["b"] = 2;
+    map["a"] = 1;
+    map["b"] += 10;
+    assert(map.at("b") == 12 && map.at("a") == 1);
+
+    [[maybe_unused]] auto [inserted, wasInserted] = map.try_emplace("c", 3);
+    assert(wasInserted && inserted->first == "c" && inserted->second == 3);
+
+    // try_emplace leaves an existing entry and a movable argument alone.
+    std::string value = "unused";
+    RBMap<int, std::string> names;
+    names.try_emplace(1, "one");
+    [[maybe_unused]] auto [existing, again] = names.try_emplace(1, std::move(value));
+    assert(!again && existing->second == "one" && value == "unused");
+
+    [[maybe_unused]] auto [assigned, fresh] = names.insert_or_assign(1, "uno");
+    assert(!fresh && assigned->second == "uno" && names.at(1) == "uno");
+    assert(names.insert_or_assign(2, "dos").second);
+
+    assert(!names.insert({1, "ignored"}).second);
+    assert(names.emplace(3, "tres").second && !names.emplace(3, "drei").second);
+    assert(names.count(3) == 1 && names.at(3) == "tres");
+
+    // Lookups only need a key, never a placeholder pair.
+    auto it = map.find(std::string_view("a"));
+    assert(it != map.end() && it->second == 1);
+    it->second = 100;
+    assert(map.at("a") == 100);
+    assert(map.contains("c") && !map.contains("z"));
+
+    map.remove("a");
+    assert(!map.contains("a"));
+    [[maybe_unused]] bool threw = false;
+    try {
+        map.at("a");
+    } catch (const std::out_of_range&) {
+        threw = true;
+    }
+    assert(threw);
+
+    RBMap<int, int> squares;
+    for (int i = 0; i < 1000; ++i)
+        squares[(i * 37) % 1000] = i;
+    for (int i = 0; i < 1000; i += 2)
+        squares.remove(i);
+    assert(squares.isValid());
+    assert(!squares.contains(0) && squares.at(37) == 1);
+
+    std::cout << "Test: Map successful." << std::endl;
+}
+
+void testIterators() {
+    using Iterator = RBTree<int>::const_iterator;
+    static_assert(std::bidirectional_iterator<Iterator>);
+    static_assert(std::is_trivially_copyable_v<Iterator> && sizeof(Iterator) == sizeof(void*));
+
+    RBTree<int> tree;
+    assert(tree.begin() == tree.end() && tree.empty());
+    std::vector<int> expected;
+    for (int i = 0; i < 500; ++i) {
+        tree.insert((i * 37) % 500);
+        expected.push_back(i);
+    }
+
+    std::vector<int> forward;
+    for (int value : tree)
+        forward.push_back(value);
+    assert(forward == expected);
+
+    std::vector<int> backward(tree.rbegin(), tree.rend());
+    assert(std::equal(backward.begin(), backward.end(), expected.rbegin()));
+    assert(std::is_sorted(tree.begin(), tree.end()));
+    assert(*std::prev(tree.end()) == 499);
+    assert(std::distance(tree.begin(), tree.end()) == 500);
+
+    [[maybe_unused]] auto it = tree.find(250);
+    assert(*--it == 249 && *++it == 250 && *++it == 251);
+
+    // Erasing through an iterator hands back the next element.
+    for (auto pos = tree.begin(); pos != tree.end();)
+        pos = (*pos % 2 == 0) ? tree.erase(pos) : std::next(pos);
+    assert(tree.isValid());
+    assert(std::all_of(tree.begin(), tree.end(), [](int v) { return v % 2 == 1; }));
+    assert(std::distance(tree.begin(), tree.end()) == 250);
+
+    // Map iterators can modify the mapped value.
+    RBMap<int, int> map;
+    for (int i = 0; i < 10; ++i)
+        map[i] = i;
+    for (auto& [key, value] : map)
+        value = key * key;
+    int sum = 0;
+    for (const auto& [key, value] : map)
+        sum += value;
+    assert(sum == 285);
+
+    std::cout << "Test: Iterators successful." << std::endl;
+}
+
+void testRangeQueries() {
+    RBTree<int> tree;
+    for (int i = 0; i < 100; i += 10)
+        tree.insert(i);
+    tree.insert(50);
+
+    assert(*tree.lower_bound(30) == 30 && *tree.upper_bound(30) == 40);
+    assert(*tree.lower_bound(31) == 40 && *tree.upper_bound(31) == 40);
+    assert(tree.lower_bound(91) == tree.end() && tree.upper_bound(90) == tree.end());
+    assert(tree.lower_bound(-5) == tree.begin());
+
+    [[maybe_unused]] auto [first, last] = tree.equal_range(50);
+    assert(std::distance(first, last) == 2 && *first == 50 && *last == 60);
+    [[maybe_unused]] auto [none, alsoNone] = tree.equal_range(55);
+    assert(none == alsoNone && *none == 60);
+
+    std::vector<int> visited;
+    tree.for_each_in_range(20, 60, [&](int v) { visited.push_back(v); });
+    assert((visited == std::vector<int>{20, 30, 40, 50, 50}));
+
+    visited.clear();
+    tree.for_each_in_range(95, 200, [&](int v) { visited.push_back(v); });
+    tree.for_each_in_range(40, 40, [&](int v) { visited.push_back(v); });
+    assert(visited.empty());
+
+    // Time-window scan over a map with heterogeneous bounds.
+    RBMap<std::string, int> events;
+    events["2024-01-01"] = 1;
+    events["2024-01-15"] = 2;
+    events["2024-02-01"] = 3;
+    events["2024-03-01"] = 4;
+    int total = 0;
+    events.for_each_in_range(std::string_view("2024-01"), std::string_view("2024-02"),
+                             [&](auto& entry) { total += entry.second; });
+    assert(total == 3);
+    assert(events.lower_bound(std::string_view("2024-02"))->second == 3);
+
+    std::cout << "Test: Range queries successful." << std::endl;
+}
+
+void testBulkLoad() {
+    for (int n = 0; n < 300; ++n) {
+        std::vector<int> values(n);
+        for (int i = 0; i < n; ++i)
+            values[i] = i / 2; // with duplicates
+        auto tree = RBTree<int>::from_sorted(values.begin(), values.end(), true);
+        assert(tree.isValid());
+        assert(std::equal(tree.begin(), tree.end(), values.begin(), values.end()));
+    }
+
+    // The built tree keeps working as a normal tree.
+    std::vector<int> big(100000);
+    for (int i = 0; i < 100000; ++i)
+        big[i] = i * 2;
+    auto tree = RBTree<int>::from_sorted(big.begin(), big.end());
+    tree.insert(7);
+    tree.remove(8);
+    assert(tree.isValid() && tree.contains(7) && !tree.contains(8));
+
+    std::vector<int> unsorted{3, 1, 2};
+    [[maybe_unused]] bool threw = false;
+    try {
+        RBTree<int>::from_sorted(unsorted.begin(), unsorted.end(), true);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Large enough to split the sort across the pool.
+    std::vector<int> shuffled(200000);
+    for (int i = 0; i < 200000; ++i)
+        shuffled[i] = static_cast<int>((i * 7919LL) % 100000);
+    WorkStealingPool pool(4);
+    auto fromUnsorted = RBTree<int>::from_unsorted(shuffled.begin(), shuffled.end(), Parallelism{pool});
+    assert(fromUnsorted.isValid());
+    assert(std::distance(fromUnsorted.begin(), fromUnsorted.end()) == 200000);
+    assert(std::is_sorted(fromUnsorted.begin(), fromUnsorted.end()));
+    auto sequentialUnsorted = RBTree<int>::from_unsorted(shuffled.begin(), shuffled.end());
+    assert(std::equal(fromUnsorted.begin(), fromUnsorted.end(), sequentialUnsorted.begin(), sequentialUnsorted.end()));
+
+    std::vector<std::pair<int, std::string>> entries{{3, "c"}, {1, "a"}, {3, "dup"}, {2, "b"}};
+    auto map = RBMap<int, std::string>::from_unsorted(entries.begin(), entries.end());
+    assert(map.isValid() && std::distance(map.begin(), map.end()) == 3 && map.at(3) == "c");
+
+    std::vector<std::pair<int, std::string>> sortedEntries{{1, "a"}, {2, "b"}, {3, "c"}};
+    auto sortedMap = RBMap<int, std::string>::from_sorted(std::make_move_iterator(sortedEntries.begin()),
+                                                          std::make_move_iterator(sortedEntries.end()), true);
+    assert(sortedMap.isValid() && sortedMap.at(2) == "b");
+
+    std::cout << "Test: Bulk load successful." << std::endl;
+}
+
+void testHintedInsert() {
+    // Ascending appends compare against the maximum only.
+    RBTree<int, CountingCompare> appended;
+    CountingCompare::calls = 0;
+    for (int i = 0; i < 10000; ++i)
+        appended.insert(i);
+    assert(CountingCompare::calls <= 10000);
+    assert(appended.isValid());
+    appended.remove(9999);
+    appended.insert(9999);
+    assert(appended.isValid() && *std::prev(appended.end()) == 9999);
+
+    // Inserting before the previous result builds a descending run with at
+    // most two comparisons per element.
+    RBTree<int, CountingCompare> hinted;
+    CountingCompare::calls = 0;
+    auto hint = hinted.end();
+    for (int i = 10000; i-- > 0;)
+        hint = hinted.insert(hint, i);
+    assert(CountingCompare::calls <= 2 * 10000);
+    assert(hinted.isValid() && *hinted.begin() == 0);
+
+    // Duplicates land right before the hint; wrong hints still work.
+    RBTree<int> multi;
+    for (int i = 0; i < 100; ++i)
+        multi.insert(i % 10 * 10);
+    [[maybe_unused]] auto at = multi.insert(multi.lower_bound(50), 50);
+    assert(at == multi.lower_bound(50));
+    multi.insert(multi.begin(), 95);
+    multi.emplace_hint(multi.end(), 5);
+    assert(multi.isValid() && std::is_sorted(multi.begin(), multi.end()));
+    assert(multi.count(50) == 11 && multi.count(95) == 1 && multi.count(5) == 1);
+
+    RBMap<int, std::string> map;
+    auto pos = map.end();
+    for (int i = 0; i < 100; i += 2)
+        pos = std::next(map.insert(pos, {i, "even"}));
+    assert(map.isValid() && pos == map.end());
+    [[maybe_unused]] auto existing = map.insert(map.find(10), {10, "again"});
+    assert(existing->second == "even");
+    assert(map.emplace_hint(map.find(10), 9, "odd")->second == "odd");
+    assert(map.emplace_hint(map.begin(), 51, "odd")->first == 51);
+    assert(map.isValid() && std::distance(map.begin(), map.end()) == 52);
+
+    std::cout << "Test: Hinted insert successful." << std::endl;
+}
+
+void testExtremes() {
+    RBTree<int> tree;
+    assert(tree.empty() && tree.size() == 0 && tree.begin() == tree.end());
+    for (int i = 0; i < 1000; ++i)
+        tree.insert((i * 37) % 1000);
+    assert(tree.size() == 1000 && !tree.empty());
+    assert(tree.min() == 0 && tree.max() == 999);
+    assert(*tree.begin() == 0 && *tree.rbegin() == 999);
+
+    // Drain from both ends like a scheduler picking the next deadline.
+    for (int i = 0; i < 500; ++i) {
+        assert(tree.pop_min() == i);
+        assert(tree.pop_max() == 999 - i);
+        assert(i % 50 != 0 || tree.isValid());
+        assert(tree.size() == static_cast<std::size_t>(998 - 2 * i));
+    }
+    assert(tree.empty() && tree.isValid() && tree.begin() == tree.end());
+
+    tree.insert(5);
+    tree.insert(3);
+    tree.remove(5);
+    assert(tree.min() == 3 && tree.max() == 3 && tree.size() == 1);
+
+    RBTree<int> copy(tree);
+    RBTree<int> moved(std::move(tree));
+    assert(copy.size() == 1 && moved.size() == 1 && tree.size() == 0);
+    assert(copy.isValid() && moved.isValid() && tree.isValid());
+    moved.clear();
+    assert(moved.empty() && moved.isValid());
+
+    RBMap<int, std::string> map;
+    map[2] = "b";
+    map[1] = "a";
+    map[3] = "c";
+    assert(map.size() == 3 && map.min().second == "a" && map.max().first == 3);
+    auto first = map.pop_min();
+    assert(first.first == 1 && first.second == "a");
+    assert(map.size() == 2 && map.min().first == 2 && map.isValid());
+
+    std::cout << "Test: Extremes successful." << std::endl;
+}
+
+void testOrderStatistics() {
+    using StatsTree = RBTree<long, std::less<>, std::allocator<long>, OrderStatistics>;
+    // Subtree sizes cost one word per node and nothing when not requested.
+    static_assert(StatsTree::nodeBytes == RBTree<long>::nodeBytes + sizeof(std::size_t));
+
+    // A sliding window of latencies, checked against a sorted copy.
+    StatsTree window;
+    std::vector<long> samples;
+    for (long i = 0; i < 3000; ++i)
+        samples.push_back((i * 7919) % 1000);
+    std::vector<long> sorted;
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+        window.insert(samples[i]);
+        sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), samples[i]), samples[i]);
+        if (i >= 500) {
+            window.remove(samples[i - 500]);
+            sorted.erase(std::lower_bound(sorted.begin(), sorted.end(), samples[i - 500]));
+        }
+        if (i % 97 == 0) {
+            assert(window.isValid());
+            for (std::size_t k = 0; k < sorted.size(); k += 37)
+                assert(*window.select(k) == sorted[k]);
+            long probe = static_cast<long>(i % 1000);
+            [[maybe_unused]] auto rank = static_cast<std::size_t>(std::lower_bound(sorted.begin(), sorted.end(), probe) - sorted.begin());
+            assert(window.rank(probe) == rank);
+        }
+    }
+    assert(window.select(window.size()) == window.end());
+    [[maybe_unused]] std::size_t p99 = window.size() * 99 / 100;
+    assert(*window.select(p99) == sorted[p99]);
+    [[maybe_unused]] auto inRange = std::lower_bound(sorted.begin(), sorted.end(), 600) - std::lower_bound(sorted.begin(), sorted.end(), 200);
+    assert(window.count_between(200, 600) == static_cast<std::size_t>(inRange));
+    assert(window.count_between(600, 200) == 0);
+
+    // Sizes survive bulk builds, copies, hinted inserts and pops.
+    std::vector<long> values(1000);
+    for (long i = 0; i < 1000; ++i)
+        values[i] = i;
+    auto built = StatsTree::from_sorted(values.begin(), values.end());
+    StatsTree copy(built);
+    copy.insert(copy.end(), 1000);
+    copy.pop_min();
+    assert(built.isValid() && copy.isValid());
+    assert(*built.select(500) == 500 && *copy.select(500) == 501 && copy.rank(1000) == 999);
+
+    RBMap<std::string, int, std::less<>, std::allocator<std::pair<const std::string, int>>, OrderStatistics> map;
+    map["b"] = 2;
+    map["a"] = 1;
+    map["c"] = 3;
+    assert(map.select(1)->first == "b" && map.rank(std::string_view("c")) == 2);
+    assert(map.isValid());
+
+    std::cout << "Test: Order statistics successful." << std::endl;
+}
+
+template <typename Map>
+concept HasSubscript = requires(Map& map) { map[typename Map::key_type()]; };
+
+void testAugmentPolicies() {
+    // Per-second request counts of a rate limiter, summed over windows.
+    RBMap<int, long, std::less<>, std::allocator<std::pair<const int, long>>, RangeSum> counts;
+    long naive[1000] = {};
+    for (int i = 0; i < 5000; ++i) {
+        int second = static_cast<int>((i * 7919LL) % 1000);
+        ++naive[second];
+        auto it = counts.try_emplace(second, 0).first;
+        counts.assign(it, it->second + 1);
+    }
+    for (int second = 0; second < 1000; second += 7) {
+        counts.remove(second);
+        naive[second] = 0;
+    }
+    counts.insert_or_assign(500, 42L);
+    naive[500] = 42;
+    assert(counts.isValid());
+    for (int lo = 0; lo < 1000; lo += 97) {
+        for (int hi = lo; hi <= 1000; hi += 131) {
+            long expected = 0;
+            for (int s = lo; s < hi; ++s)
+                expected += naive[s];
+            assert(counts.aggregate(lo, hi).value_or(0) == expected);
+        }
+    }
+    assert(!counts.aggregate(10, 10) && counts.aggregate().has_value());
+    // Mapped values feed the sums, so they are only reachable as const.
+    using Counts = decltype(counts);
+    static_assert(std::is_const_v<std::remove_reference_t<decltype((counts.begin()->second))>>);
+    static_assert(!HasSubscript<Counts> && HasSubscript<RBMap<int, long>>);
+
+    RBTree<int, std::less<>, std::allocator<int>, RangeMin> values;
+    assert(!values.aggregate());
+    for (int i = 0; i < 1000; ++i)
+        values.insert((i * 37) % 1000 + 1);
+    assert(*values.aggregate(300, 400) == 300 && *values.aggregate() == 1);
+    values.pop_min();
+    assert(*values.aggregate() == 2 && values.isValid());
+
+    // Interval tree over [i, i + i % 10], with every fifth interval removed again.
+    using Span = Interval<int>;
+    RBTree<Span, std::less<>, std::allocator<Span>, IntervalOverlap> spans;
+    for (int i = 0; i < 500; ++i) {
+        int low = (i * 13) % 500;
+        spans.insert(Span{low, low + low % 10});
+    }
+    for (int i = 0; i < 500; i += 5)
+        spans.remove(Span{i, i + i % 10});
+    assert(spans.isValid());
+    for (int lo = 0; lo < 520; lo += 17) {
+        int hi = lo + lo % 4;
+        std::vector<Span> expected;
+        for (const Span& span : spans)
+            if (span.overlaps(lo, hi))
+                expected.push_back(span);
+        std::vector<Span> found;
+        spans.for_each_overlapping(lo, hi, [&](const Span& span) { found.push_back(span); });
+        assert(found == expected);
+        [[maybe_unused]] auto first = spans.find_overlapping(lo, hi);
+        assert(expected.empty() ? first == spans.end() : *first == expected.front());
+    }
+
+    std::cout << "Test: Augment policies successful." << std::endl;
+}
+
+template <typename Tree>
+std::vector<int> contents(const Tree& tree) {
+    return std::vector<int>(tree.begin(), tree.end());
+}
+
+void testJoinAndSplit() {
+    // Split at every position, then join the halves back, with and without
+    // subtree sizes.
+    auto splitEverywhere = [](auto tree) {
+        for (int n = 0; n < 200; n += 7) {
+            for (int at = -1; at <= n; at += 5) {
+                tree.clear();
+                for (int i = 0; i < n; ++i)
+                    tree.insert(i / 2);
+                std::vector<int> all = contents(tree);
+                auto right = tree.split(at);
+                assert(tree.isValid() && right.isValid());
+                [[maybe_unused]] auto cut = std::lower_bound(all.begin(), all.end(), at);
+                assert(tree.size() == static_cast<std::size_t>(cut - all.begin()));
+                assert(right.size() == static_cast<std::size_t>(all.end() - cut));
+                assert(contents(tree) == std::vector<int>(all.begin(), cut));
+                assert(contents(right) == std::vector<int>(cut, all.end()));
+                tree.join(std::move(right));
+                assert(tree.isValid() && right.empty() && contents(tree) == all);
+            }
+        }
+    };
+    splitEverywhere(RBTree<int>());
+    splitEverywhere(RBTree<int, std::less<>, std::allocator<int>, OrderStatistics>());
+
+    // Without sizes, counts left open by a split stay open through later
+    // updates and are counted once asked for.
+    RBTree<int> plain;
+    for (int i = 0; i < 100; ++i)
+        plain.insert(i);
+    RBTree<int> above = plain.split(60);
+    plain.insert(7);
+    plain.remove(3);
+    above.remove(99);
+    plain.join(std::move(above));
+    assert(plain.size() == 99 && plain.isValid() && !plain.empty());
+
+    RBTree<int> low, high;
+    for (int i = 0; i < 10; ++i)
+        low.insert(i);
+    high.insert(5);
+    [[maybe_unused]] bool threw = false;
+    try {
+        low.join(std::move(high));
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw && low.size() == 10 && high.size() == 1);
+
+    // Set operations against std::multiset algorithms.
+    for (int round = 0; round < 20; ++round) {
+        std::vector<int> a, b;
+        for (int i = 0; i < 50 * round; ++i)
+            a.push_back(static_cast<int>((i * 7919LL + round) % 300));
+        for (int i = 0; i < 37 * (20 - round); ++i)
+            b.push_back(static_cast<int>((i * 104729LL + round) % 300));
+        auto build = [](const std::vector<int>& values) {
+            RBTree<int> tree;
+            for (int v : values)
+                tree.insert(v);
+            return tree;
+        };
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        std::vector<int> merged, common, rest;
+        std::merge(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(merged));
+        for (int v : a) {
+            bool inB = std::binary_search(b.begin(), b.end(), v);
+            (inB ? common : rest).push_back(v);
+        }
+
+        RBTree<int> u = build(a);
+        u.union_with(build(b));
+        assert(u.isValid() && contents(u) == merged && u.size() == merged.size());
+        RBTree<int> i = build(a);
+        i.intersect_with(build(b));
+        assert(i.isValid() && contents(i) == common && i.size() == common.size());
+        RBTree<int> d = build(a);
+        d.difference_with(build(b));
+        assert(d.isValid() && contents(d) == rest && d.size() == rest.size());
+    }
+
+    // Maps keep their own entry on conflicts; sizes stay right with
+    // OrderStatistics.
+    using StatsMap = RBMap<int, int, std::less<>, std::allocator<std::pair<const int, int>>, OrderStatistics>;
+    StatsMap mine, theirs;
+    for (int k = 0; k < 100; ++k)
+        mine[k * 2] = 1;
+    for (int k = 0; k < 100; ++k)
+        theirs[k * 3] = 2;
+    mine.union_with(std::move(theirs));
+    assert(mine.isValid() && mine.size() == 166 && mine.at(6) == 1 && mine.at(3) == 2);
+    assert(mine.select(165)->first == 297 && mine.select(165)->second == 2);
+    StatsMap upper = mine.split(150);
+    assert(mine.isValid() && upper.isValid() && mine.rank(150) == mine.size());
+    assert(mine.size() + upper.size() == 166 && upper.begin()->first == 150);
+
+    // Trees on different pools copy the other side's nodes first.
+    RBTree<int, std::less<>, PoolAllocator<int>> pooled, otherPool;
+    for (int k = 0; k < 100; ++k) {
+        pooled.insert(k);
+        otherPool.insert(k + 50);
+    }
+    pooled.difference_with(std::move(otherPool));
+    assert(pooled.isValid() && pooled.size() == 50 && otherPool.empty());
+    pooled.union_with(std::move(pooled));
+    assert(pooled.isValid() && pooled.size() == 100 && pooled.count(49) == 2);
+
+    // Merging a small batch into a large tree costs about the batch size.
+    RBTree<int, CountingCompare> big;
+    for (int k = 0; k < 100000; ++k)
+        big.insert(k * 2);
+    RBTree<int, CountingCompare> batch;
+    for (int k = 0; k < 10; ++k)
+        batch.insert(k * 20001);
+    CountingCompare::calls = 0;
+    big.union_with(std::move(batch));
+    assert(CountingCompare::calls < 1000);
+    assert(big.isValid() && big.size() == 100010);
+
+    std::cout << "Test: Join and split successful." << std::endl;
+}
+
+void testParallelSetOperations() {
+    WorkStealingPool pool(4);
+    Parallelism par{pool, 64}; // tiny cutoff so the tests really fork
+
+    std::vector<int> evens, threes;
+    for (int i = 0; i < 20000; ++i)
+        evens.push_back(i * 2);
+    for (int i = 0; i < 15000; ++i)
+        threes.push_back(i * 3);
+
+    auto built = RBTree<int>::from_sorted(evens.begin(), evens.end(), par, true);
+    assert(built.isValid() && contents(built) == evens);
+
+    auto sequential = RBTree<int>::from_sorted(evens.begin(), evens.end());
+    sequential.union_with(RBTree<int>::from_sorted(threes.begin(), threes.end()));
+    auto parallel = RBTree<int>::from_sorted(evens.begin(), evens.end(), par);
+    parallel.union_with(RBTree<int>::from_sorted(threes.begin(), threes.end(), par), par);
+    assert(parallel.isValid() && contents(parallel) == contents(sequential));
+    assert(parallel.size() == sequential.size());
+
+    auto common = RBTree<int>::from_sorted(evens.begin(), evens.end(), par);
+    common.intersect_with(RBTree<int>::from_sorted(threes.begin(), threes.end(), par), par);
+    assert(common.isValid() && common.size() == 6667 && *common.rbegin() == 39996);
+
+    auto rest = RBTree<int>::from_sorted(evens.begin(), evens.end(), par);
+    rest.difference_with(RBTree<int>::from_sorted(threes.begin(), threes.end(), par), par);
+    assert(rest.isValid() && rest.size() == 13333 && !rest.contains(6) && rest.contains(4));
+
+    // Exceptions surface in the caller once both halves are done.
+    [[maybe_unused]] bool threw = false;
+    int ran = 0;
+    try {
+        pool.invoke([&] { ++ran; }, [] { throw std::runtime_error("task failed"); });
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw && ran == 1);
+
+    // Many tiny forks from outside the pool, so joins often wait on tasks
+    // that other workers finish.
+    std::atomic<int> visited{0};
+    for (int round = 0; round < 200; ++round)
+        parallelFor(pool, 0, 64, 1, [&](std::size_t lo, std::size_t hi) { visited += static_cast<int>(hi - lo); });
+    assert(visited == 200 * 64);
+
+    // The parallel sort keeps equal keys in input order across merges.
+    for (std::size_t n : {0, 1, 7, 100, 5000}) {
+        std::vector<std::pair<int, std::size_t>> items;
+        for (std::size_t i = 0; i < n; ++i)
+            items.emplace_back(static_cast<int>((i * 7919) % 97), i);
+        auto expected = items;
+        auto byKey = [](const auto& a, const auto& b) { return a.first < b.first; };
+        std::stable_sort(expected.begin(), expected.end(), byKey);
+        parallelStableSort(pool, items.begin(), items.end(), 16, byKey);
+        assert(items == expected);
+    }
+
+    std::cout << "Test: Parallel set operations successful." << std::endl;
+}
+
+void testPersistentTree() {
+    PersistentRBTree<int> empty;
+    assert(empty.empty() && empty.begin() == empty.end() && empty.isValid());
+
+    // Every version stays intact after later updates.
+    std::vector<PersistentRBTree<int>> versions{empty};
+    for (int i = 0; i < 1000; ++i) {
+        versions.push_back(versions.back().insert((i * 37) % 1000));
+        assert(versions.back().isValid());
+    }
+    for (int v = 0; v <= 1000; v += 100) {
+        assert(versions[v].size() == static_cast<std::size_t>(v));
+        for (int i = 0; i < 1000; ++i)
+            assert(versions[v].contains((i * 37) % 1000) == (i < v));
+    }
+    PersistentRBTree<int> full = versions.back();
+    std::vector<int> expected(1000);
+    for (int i = 0; i < 1000; ++i)
+        expected[i] = i;
+    assert(std::equal(full.begin(), full.end(), expected.begin(), expected.end()));
+
+    // No-op updates return the same version.
+    assert(full.insert(500).same_version(full));
+    assert(full.remove(1000).same_version(full));
+
+    // An update copies only O(log n) nodes.
+    [[maybe_unused]] long allocationsBefore = heapAllocations;
+    PersistentRBTree<int> withNew = full.insert(1000);
+    assert(heapAllocations - allocationsBefore <= 40);
+    allocationsBefore = heapAllocations;
+    PersistentRBTree<int> without = full.remove(500);
+    assert(heapAllocations - allocationsBefore <= 60);
+    assert(withNew.size() == 1001 && withNew.contains(1000) && !full.contains(1000));
+    assert(without.size() == 999 && !without.contains(500) && full.contains(500));
+
+    PersistentRBTree<int> shrinking = full;
+    for (int i = 0; i < 1000; i += 3) {
+        shrinking = shrinking.remove(i);
+        assert(shrinking.isValid());
+    }
+    for (int i = 0; i < 1000; ++i)
+        assert(shrinking.contains(i) == (i % 3 != 0));
+    assert(full.size() == 1000 && full.isValid());
+
+    assert(*full.lower_bound(250) == 250 && *shrinking.lower_bound(996) == 997);
+    assert(shrinking.lower_bound(999) == shrinking.end());
+    std::vector<int> range;
+    shrinking.for_each_in_range(10, 20, [&](int value) { range.push_back(value); });
+    assert((range == std::vector<int>{10, 11, 13, 14, 16, 17, 19}));
+
+    // Readers on other threads need no locks to use a snapshot.
+    PersistentRBTree<int> snapshot = full;
+    std::thread reader([snapshot] {
+        for (int i = 0; i < 1000; ++i)
+            assert(snapshot.find(i) && *snapshot.find(i) == i);
+    });
+    for (int i = 0; i < 1000; ++i)
+        full = full.remove(i);
+    reader.join();
+    assert(full.empty() && snapshot.size() == 1000);
+
+    VersionHistory<PersistentRBTree<int>> history(3);
+    PersistentRBTree<int> current;
+    for (int i = 0; i < 5; ++i)
+        assert(history.commit(current = current.insert(i)) == static_cast<std::size_t>(i));
+    assert(history.size() == 3 && history.oldest_version() == 2);
+    assert(history.at(1) == nullptr && history.at(5) == nullptr);
+    assert(history.at(2)->size() == 3 && !history.at(2)->contains(3));
+    assert(history.latest().size() == 5);
+
+    std::cout << "Test: Persistent tree successful." << std::endl;
+}
+
+void testConcurrentTree() {
+    ConcurrentRBTree<int> tree;
+    for (int i = 0; i < 1000; i += 2)
+        assert(tree.insert(i));
+    assert(!tree.insert(0) && !tree.remove(1));
+    assert(tree.size() == 500 && tree.find(10) == 10 && !tree.find(11));
+
+    // A batch is published as one version.
+    assert(tree.update([](const auto& version) { return version.insert(1).insert(3); }));
+    assert(tree.contains(1) && tree.contains(3));
+    assert(tree.remove(1) && tree.remove(3));
+
+    // Readers always see every even key and a valid version while a writer
+    // adds and removes the odd ones.
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; ++r) {
+        readers.emplace_back([&, r] {
+            for (int round = 0; !stop; ++round) {
+                [[maybe_unused]] int key = (round * 2 + r * 250) % 1000;
+                assert(tree.contains(key));
+                if (round % 64 == 0) {
+                    tree.read([]([[maybe_unused]] const auto& version) { assert(version.isValid()); });
+                    std::size_t evens = 0;
+                    tree.for_each_in_range(0, 99, [&](int value) { evens += value % 2 == 0; });
+                    assert(evens == 50);
+                }
+            }
+        });
+    }
+    auto before = tree.snapshot();
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 1; i < 1000; i += 2)
+            assert(tree.insert(i));
+        for (int i = 1; i < 1000; i += 2)
+            assert(tree.remove(i));
+    }
+    stop = true;
+    for (auto& reader : readers)
+        reader.join();
+    assert(tree.size() == 500 && before.size() == 500 && before.isValid());
+
+    std::cout << "Test: Concurrent tree successful." << std::endl;
+}
+
+void testShardedTree() {
+    ShardedRBTree<int> tree(4);
+    assert(tree.shard_count() == 4 && tree.empty());
+
+    // Ascending inserts pile into the last shard until rebalancing spreads
+    // them out.
+    for (int i = 0; i < 10000; ++i)
+        tree.insert(i);
+    assert(tree.size() == 10000 && tree.isValid());
+    for ([[maybe_unused]] const auto& shard : tree.stats())
+        assert(shard.size > 0 && shard.size <= 5000);
+
+    tree.rebalance();
+    assert(tree.isValid());
+    for ([[maybe_unused]] const auto& shard : tree.stats())
+        assert(shard.size == 2500);
+
+    assert(tree.contains(1234) && tree.find(1234) == 1234 && !tree.find(10000));
+    tree.insert(1234);
+    assert(tree.count(1234) == 2 && tree.remove(1234) && tree.count(1234) == 1);
+    assert(!tree.remove(-1));
+
+    // Scans cross shard boundaries in order.
+    std::vector<int> range;
+    tree.for_each_in_range(2490, 2510, [&](int value) { range.push_back(value); });
+    assert(range.size() == 20 && std::is_sorted(range.begin(), range.end()));
+    std::size_t visited = 0;
+    int previous = -1;
+    tree.for_each([&](int value) {
+        assert(value > previous);
+        previous = value;
+        ++visited;
+    });
+    assert(visited == 10000);
+
+    // Mixed operations from several threads, with rebalances on the way.
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t) {
+        workers.emplace_back([&, t] {
+            for (int i = 0; i < 5000; ++i) {
+                int key = 10000 + t * 5000 + i;
+                tree.insert(key);
+                assert(tree.contains(key));
+                if (i % 2 == 0)
+                    assert(tree.remove(key));
+            }
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    assert(tree.size() == 20000 && tree.isValid());
+    std::uint64_t acquisitions = 0;
+    for (const auto& shard : tree.stats())
+        acquisitions += shard.acquisitions;
+    assert(acquisitions >= 40000);
+
+    std::cout << "Test: Sharded tree successful." << std::endl;
+}
+
+void testApplyBatch() {
+    using Op = RBTree<int>::Op;
+
+    // Inserts and removes cancel per key; removes beyond what is there do
+    // nothing.
+    RBTree<int> tree;
+    for (int i = 0; i < 10; ++i)
+        tree.insert(i);
+    std::vector<Op> ops{{Op::Insert, 20}, {Op::Remove, 20}, {Op::Remove, 3}, {Op::Remove, 3},
+                        {Op::Insert, 5},  {Op::Remove, 42}, {Op::Insert, -1}, {Op::Remove, 9},
+                        {Op::Insert, 9}};
+    RBTree<int> consumed = tree;
+    tree.apply_batch(ops);
+    assert(tree.isValid());
+    assert((contents(tree) == std::vector<int>{-1, 0, 1, 2, 4, 5, 5, 6, 7, 8, 9}));
+    assert(ops.size() == 9 && ops[0].value == 20 && ops[8].kind == Op::Insert); // borrowed, so untouched
+    consumed.apply_batch(std::move(ops));
+    assert(consumed.isValid() && contents(consumed) == contents(tree));
+
+    // Borrowed strings are sorted through pointers and copied in.
+    RBTree<std::string> words;
+    words.insert("b");
+    using WordOp = RBTree<std::string>::Op;
+    std::vector<WordOp> wordOps{{WordOp::Insert, "c"}, {WordOp::Remove, "b"}, {WordOp::Insert, "a"}};
+    words.apply_batch(wordOps);
+    assert(words.isValid() && words.size() == 2 && *words.begin() == "a" && wordOps[0].value == "c");
+
+    // Dense and sparse sweeps and the parallel version all match applying
+    // the ops one at a time.
+    WorkStealingPool pool(4);
+    Parallelism par{pool, 64};
+    std::vector<Op> batch;
+    for (int i = 0; i < 30000; ++i)
+        batch.push_back({(i * 7) % 3 == 0 ? Op::Remove : Op::Insert, (i * 7919) % 5000});
+    std::vector<int> start;
+    for (int i = 0; i < 5000; i += 3)
+        start.push_back(i);
+    RBTree<int> expected = RBTree<int>::from_sorted(start.begin(), start.end());
+    for (const Op& op : batch) {
+        if (op.kind == Op::Insert)
+            expected.insert(op.value);
+        else
+            expected.remove(op.value);
+    }
+
+    auto sequential = RBTree<int>::from_sorted(start.begin(), start.end());
+    sequential.apply_batch(batch);
+    assert(sequential.isValid() && contents(sequential) == contents(expected));
+
+    auto parallel = RBTree<int>::from_sorted(start.begin(), start.end());
+    parallel.apply_batch(batch, par);
+    assert(parallel.isValid() && contents(parallel) == contents(expected));
+
+    auto moved = RBTree<int>::from_sorted(start.begin(), start.end());
+    moved.apply_batch(std::move(batch));
+    assert(moved.isValid() && contents(moved) == contents(expected));
+
+    // Sparse batches locate their keys by descents from the root, here
+    // over several chunks.
+    std::vector<int> wide;
+    for (int i = 0; i < 100000; ++i)
+        wide.push_back(i);
+    auto large = RBTree<int>::from_sorted(wide.begin(), wide.end());
+    auto largeExpected = large;
+    std::vector<Op> sparse;
+    for (int i = 0; i < 5000; ++i) {
+        sparse.push_back({i % 2 ? Op::Remove : Op::Insert, (i * 7919) % 100000});
+        if (sparse.back().kind == Op::Insert)
+            largeExpected.insert(sparse.back().value);
+        else
+            largeExpected.remove(sparse.back().value);
+    }
+    large.apply_batch(sparse);
+    assert(large.isValid() && contents(large) == contents(largeExpected));
+
+    // Augmented trees keep their aggregates through both paths.
+    RBTree<int, std::less<>, std::allocator<int>, OrderStatistics> ranked;
+    using RankedOp = decltype(ranked)::Op;
+    std::vector<RankedOp> rankedOps;
+    for (int i = 0; i < 1000; ++i)
+        rankedOps.push_back({RankedOp::Insert, (i * 37) % 1000});
+    ranked.apply_batch(rankedOps, par);
+    rankedOps.clear();
+    for (int i = 0; i < 1000; i += 2)
+        rankedOps.push_back({RankedOp::Remove, i});
+    ranked.apply_batch(rankedOps);
+    assert(ranked.isValid() && ranked.size() == 500 && *ranked.select(10) == 21);
+
+    std::vector<Op> none;
+    tree.apply_batch(none);
+    tree.apply_batch(none, par);
+    assert(tree.size() == 11);
+
+    std::cout << "Test: Apply batch successful." << std::endl;
+}
+
+void testFindMany() {
+    RBTree<int> tree;
+    std::vector<int> keys;
+    for (int i = 0; i < 3000; ++i) {
+        tree.insert((i * 7919) % 3000 * 2);
+        keys.push_back((i * 104729) % 6001);
+    }
+    std::vector<RBTree<int>::const_iterator> out(keys.size());
+    tree.find_many(keys, out);
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        assert(out[i] == tree.find(keys[i]));
+
+    RBTree<std::string> words;
+    for (const char* word : {"pear", "apple", "fig"})
+        words.insert(word);
+    std::vector<std::string_view> views{"fig", "kiwi", "apple"};
+    std::vector<RBTree<std::string>::const_iterator> found(views.size());
+    words.find_many<std::string_view>(views, found);
+    assert(*found[0] == "fig" && found[1] == words.end() && *found[2] == "apple");
+
+    RBTree<int> empty;
+    empty.find_many(keys, out);
+    assert(std::all_of(out.begin(), out.end(), [&](auto it) { return it == empty.end(); }));
+
+    [[maybe_unused]] bool threw = false;
+    try {
+        tree.find_many(keys, std::span(out).first(10));
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::cout << "Test: Find many successful." << std::endl;
+}
+
+void testFreeze() {
+    // Every shape of the last level, with runs of equal keys.
+    for (int n = 0; n < 70; ++n) {
+        RBTree<int> tree;
+        for (int i = 0; i < n; ++i)
+            tree.insert((i * 37) % n / 2 * 2);
+        FrozenTree frozen(tree);
+        assert(frozen.size() == tree.size());
+        assert(std::vector<int>(frozen.begin(), frozen.end()) == std::vector<int>(tree.begin(), tree.end()));
+        for (int key = -1; key <= n + 1; ++key) {
+            [[maybe_unused]] auto lower = frozen.lower_bound(key);
+            [[maybe_unused]] auto upper = frozen.upper_bound(key);
+            assert((lower == frozen.end()) == (tree.lower_bound(key) == tree.end()));
+            assert(lower == frozen.end() || *lower == *tree.lower_bound(key));
+            assert((upper == frozen.end()) == (tree.upper_bound(key) == tree.end()));
+            assert(upper == frozen.end() || *upper == *tree.upper_bound(key));
+            assert(frozen.contains(key) == tree.contains(key) && frozen.count(key) == tree.count(key));
+            assert(std::distance(lower, upper) == static_cast<std::ptrdiff_t>(tree.count(key)));
+            [[maybe_unused]] auto found = frozen.find(key);
+            assert(found == frozen.end() ? !tree.contains(key) : *found == key && found == lower);
+        }
+        std::vector<int> inRange, expected;
+        frozen.for_each_in_range(n / 4, n / 2, [&](int value) { inRange.push_back(value); });
+        tree.for_each_in_range(n / 4, n / 2, [&](int value) { expected.push_back(value); });
+        assert(inRange == expected);
+    }
+
+    RBTree<std::string> words;
+    for (const char* word : {"pear", "apple", "fig"})
+        words.insert(word);
+    FrozenTree frozenWords(words);
+    assert(frozenWords.contains(std::string_view("fig")) && !frozenWords.contains(std::string_view("kiwi")));
+    assert(*frozenWords.lower_bound(std::string_view("b")) == "fig");
+
+    RBTree<int, CountingCompare> counted;
+    for (int i = 0; i < 1000; ++i)
+        counted.insert(i);
+    FrozenTree frozenCounted(counted);
+    assert(frozenCounted.contains(999) && !frozenCounted.contains(1000));
+
+    std::cout << "Test: Freeze successful." << std::endl;
+}
+
+// Checks every lookup of a FrozenBTree copied from tree, on each instruction set the
+// CPU has, against binary searches over the sorted elements.
+template <typename T>
+void checkFrozenBTree(const RBTree<T>& tree, const std::vector<T>& queries) {
+    using Frozen = FrozenBTree<T>;
+    std::vector<T> sorted(tree.begin(), tree.end());
+    for (auto isa : {Frozen::Isa::Scalar, Frozen::Isa::Sse42, Frozen::Isa::Avx2}) {
+        Frozen frozen(tree, isa);
+        assert(std::equal(frozen.begin(), frozen.end(), sorted.begin(), sorted.end()));
+        std::vector<typename Frozen::const_iterator> found(queries.size());
+        frozen.find_many(queries, found);
+        for (std::size_t i = 0; i < queries.size(); ++i) {
+            T key = queries[i];
+            auto lower = std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+            auto upper = std::upper_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+            assert(frozen.lower_bound(key) - frozen.begin() == lower);
+            assert(frozen.upper_bound(key) - frozen.begin() == upper);
+            assert(frozen.count(key) == static_cast<std::size_t>(upper - lower));
+            [[maybe_unused]] auto expected = lower < upper ? frozen.begin() + lower : frozen.end();
+            assert(frozen.find(key) == expected && found[i] == expected);
+        }
+    }
+}
+
+void testFreezeBTree() {
+    // One to four layers, with runs of equal keys and the padding value
+    // itself stored.
+    for (int n : {0, 1, 15, 16, 17, 271, 272, 273, 300, 4625, 20000}) {
+        RBTree<int> ints;
+        RBTree<long> longs;
+        RBTree<double> doubles;
+        RBTree<unsigned short> shorts;
+        std::vector<int> intQueries{std::numeric_limits<int>::min(), std::numeric_limits<int>::max()};
+        for (int i = 0; i < n; ++i) {
+            int value = (i * 7919) % n / 3 * 2 - n / 2;
+            ints.insert(value);
+            longs.insert(value * 3000000000L);
+            doubles.insert(value * 0.5);
+            shorts.insert(static_cast<unsigned short>(value + n));
+        }
+        ints.insert(std::numeric_limits<int>::max());
+        for (int key = -n / 2 - 2; key <= n / 2 + 2; key += std::max(1, n / 500))
+            intQueries.push_back(key);
+
+        std::vector<long> longQueries;
+        std::vector<double> doubleQueries{-std::numeric_limits<double>::infinity(),
+                                          std::numeric_limits<double>::infinity()};
+        std::vector<unsigned short> shortQueries;
+        for (int key : intQueries) {
+            longQueries.push_back(key * 3000000000L + (key % 2));
+            doubleQueries.push_back(key * 0.5);
+            shortQueries.push_back(static_cast<unsigned short>(key + n));
+        }
+        checkFrozenBTree(ints, intQueries);
+        checkFrozenBTree(longs, longQueries);
+        checkFrozenBTree(doubles, doubleQueries);
+        checkFrozenBTree(shorts, shortQueries);
+    }
+
+    RBTree<float> floats;
+    for (int i = 0; i < 1000; ++i)
+        floats.insert(i * 0.25f);
+    FrozenBTree frozen(floats);
+    std::vector<float> inRange;
+    frozen.for_each_in_range(10.0f, 11.0f, [&](float value) { inRange.push_back(value); });
+    assert((inRange == std::vector<float>{10.0f, 10.25f, 10.5f, 10.75f}));
+    assert(frozen.contains(0.0f) && frozen.contains(-0.0f) && !frozen.contains(0.1f));
+
+    std::cout << "Test: Freeze B-tree successful." << std::endl;
+}
+
 int main() {
     testInsertion();
     testDeletion();
     testSearch();
+    testCopyAndMove();
+    testRemoveAll();
+    testChurnMemory();
+    testPoolAllocator();
+    testPmrAllocator();
+    testArenaTree();
+    testNodeLayout();
+    testInsertCopies();
+    testHeterogeneousLookup();
+    testCustomCompare();
+    testMap();
+    testIterators();
+    testRangeQueries();
+    testBulkLoad();
+    testHintedInsert();
+    testExtremes();
+    testOrderStatistics();
+    testAugmentPolicies();
+    testJoinAndSplit();
+    testParallelSetOperations();
+    testPersistentTree();
+    testConcurrentTree();
+    testShardedTree();
+    testApplyBatch();
+    testFindMany();
+    testFreeze();
+    testFreezeBTree();
 
     std::cout << "All tests successful!" << std::endl;
     return 0;